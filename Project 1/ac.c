@@ -0,0 +1,229 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ac.h"
+#include "mu.h"
+
+/*
+ * delta[] entries are the premultiplied row offset of the next state
+ * (state * nclasses), so the scan loop needs no multiply.  The top bit is
+ * set when the next state, or any state on its fail chain, ends a pattern.
+ */
+#define AC_MATCH    (1U << 31)
+#define AC_OFFSET   (~AC_MATCH)
+
+static inline unsigned char
+fold(unsigned char c)
+{
+    return (unsigned char)(c - 'A') < 26 ? c | 0x20 : c;
+}
+
+void
+ac_init(struct ac *ac, bool icase)
+{
+    mu_memzero_p(ac);
+    ac->icase = icase;
+}
+
+void
+ac_deinit(struct ac *ac)
+{
+    size_t i;
+
+    for (i = 0; i < ac->npatterns; i++)
+        free(ac->patterns[i]);
+
+    free(ac->patterns);
+    free(ac->lens);
+    free(ac->next_same);
+    free(ac->delta);
+    free(ac->out);
+    free(ac->dict);
+    mu_memzero_p(ac);
+}
+
+size_t
+ac_add(struct ac *ac, const char *pattern, size_t len)
+{
+    size_t id = ac->npatterns;
+
+    assert(ac->delta == NULL);
+
+    ac->patterns = mu_reallocarray(ac->patterns, id + 1, sizeof(*ac->patterns));
+    ac->lens = mu_reallocarray(ac->lens, id + 1, sizeof(*ac->lens));
+
+    ac->patterns[id] = mu_calloc(1, len + 1);
+    memcpy(ac->patterns[id], pattern, len);
+    ac->lens[id] = len;
+    ac->npatterns++;
+
+    return id;
+}
+
+/* Assign a class to every byte that appears in a pattern; all others get 0. */
+static void
+ac_compute_classes(struct ac *ac)
+{
+    unsigned char c;
+    size_t i, j;
+    int b;
+
+    memset(ac->cls, 0, sizeof(ac->cls));
+    ac->nclasses = 1;
+
+    for (i = 0; i < ac->npatterns; i++) {
+        for (j = 0; j < ac->lens[i]; j++) {
+            c = (unsigned char)ac->patterns[i][j];
+            if (ac->icase)
+                c = fold(c);
+            if (ac->cls[c] == 0)
+                ac->cls[c] = (uint16_t)ac->nclasses++;
+        }
+    }
+
+    if (ac->icase) {
+        for (b = 'A'; b <= 'Z'; b++)
+            ac->cls[b] = ac->cls[fold((unsigned char)b)];
+    }
+}
+
+void
+ac_compile(struct ac *ac)
+{
+    size_t max_states = 1, nc, i, j, head = 0, tail = 0;
+    uint32_t *trie, *fail, *queue, s, t, f, c;
+    bool *match;
+
+    assert(ac->delta == NULL);
+
+    for (i = 0; i < ac->npatterns; i++)
+        max_states += ac->lens[i];
+
+    ac_compute_classes(ac);
+    nc = ac->nclasses;
+
+    /* build the trie; 0 means "no edge" since no edge leads back to the root */
+    trie = mu_calloc(max_states * nc, sizeof(*trie));
+    ac->out = mu_mallocarray(max_states, sizeof(*ac->out));
+    ac->next_same = mu_mallocarray(ac->npatterns, sizeof(*ac->next_same));
+    memset(ac->out, 0xff, max_states * sizeof(*ac->out));
+    memset(ac->next_same, 0xff, ac->npatterns * sizeof(*ac->next_same));
+    ac->nstates = 1;
+
+    for (i = 0; i < ac->npatterns; i++) {
+        s = 0;
+        for (j = 0; j < ac->lens[i]; j++) {
+            c = ac->cls[(unsigned char)ac->patterns[i][j]];
+            if (trie[s * nc + c] == 0)
+                trie[s * nc + c] = (uint32_t)ac->nstates++;
+            s = trie[s * nc + c];
+        }
+
+        if (s == 0)
+            ac->has_empty = true;
+
+        /* duplicate patterns share a state; chain them so each one is reported */
+        if (ac->out[s] != AC_NONE)
+            ac->next_same[i] = ac->out[s];
+        ac->out[s] = (uint32_t)i;
+    }
+
+    /* breadth-first, fill in failure links and fold them into the table */
+    fail = mu_calloc(ac->nstates, sizeof(*fail));
+    queue = mu_mallocarray(ac->nstates, sizeof(*queue));
+    match = mu_calloc(ac->nstates, sizeof(*match));
+    ac->dict = mu_mallocarray(ac->nstates, sizeof(*ac->dict));
+
+    ac->dict[0] = AC_NONE;
+    match[0] = ac->out[0] != AC_NONE;
+    queue[tail++] = 0;
+
+    while (head < tail) {
+        s = queue[head++];
+        f = fail[s];
+
+        for (c = 0; c < nc; c++) {
+            t = trie[s * nc + c];
+            if (t == 0) {
+                trie[s * nc + c] = s == 0 ? 0 : trie[f * nc + c];
+                continue;
+            }
+
+            fail[t] = s == 0 ? 0 : trie[f * nc + c];
+            ac->dict[t] = ac->out[fail[t]] != AC_NONE ? fail[t] : ac->dict[fail[t]];
+            match[t] = ac->out[t] != AC_NONE || match[fail[t]];
+            queue[tail++] = t;
+        }
+    }
+
+    if (ac->nstates * nc > AC_OFFSET)
+        mu_die("too many patterns: the automaton needs %zu states", ac->nstates);
+
+    /* premultiply and tag the matching states */
+    for (i = 0; i < ac->nstates * nc; i++) {
+        t = trie[i];
+        trie[i] = (uint32_t)(t * nc) | (match[t] ? AC_MATCH : 0);
+    }
+
+    ac->delta = mu_reallocarray(trie, ac->nstates * nc, sizeof(*trie));
+
+    free(fail);
+    free(queue);
+    free(match);
+}
+
+const char *
+ac_find(const struct ac *ac, const char *p, size_t len)
+{
+    const uint32_t *delta = ac->delta;
+    const uint16_t *cls = ac->cls;
+    uint32_t s = 0;
+    size_t i;
+
+    if (ac->has_empty)
+        return p;
+
+    for (i = 0; i < len; i++) {
+        s = delta[(s & AC_OFFSET) + cls[(unsigned char)p[i]]];
+        if (s & AC_MATCH)
+            return p + i;
+    }
+
+    return NULL;
+}
+
+static void
+ac_report(const struct ac *ac, uint32_t id, void (*fn)(size_t id, void *arg), void *arg)
+{
+    for (; id != AC_NONE; id = ac->next_same[id])
+        fn(id, arg);
+}
+
+void
+ac_foreach(const struct ac *ac, const char *p, size_t len,
+        void (*fn)(size_t id, void *arg), void *arg)
+{
+    const uint32_t *delta = ac->delta;
+    uint32_t s = 0, t;
+    size_t i;
+
+    /* the empty pattern is reported once, not at every position */
+    if (ac->has_empty)
+        ac_report(ac, ac->out[0], fn, arg);
+
+    for (i = 0; i < len; i++) {
+        s = delta[(s & AC_OFFSET) + ac->cls[(unsigned char)p[i]]];
+        if (!(s & AC_MATCH))
+            continue;
+
+        t = (s & AC_OFFSET) / (uint32_t)ac->nclasses;
+        if (ac->out[t] == AC_NONE)
+            t = ac->dict[t];
+
+        for (; t != 0 && t != AC_NONE; t = ac->dict[t])
+            ac_report(ac, ac->out[t], fn, arg);
+    }
+}
@@ -0,0 +1,57 @@
+#ifndef _AC_H_
+#define _AC_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * Aho-Corasick automaton for matching many literal patterns in one pass.
+ *
+ * Bytes are first mapped to equivalence classes (every byte that appears in
+ * no pattern shares class 0), so each state's row in the transition table
+ * is only as wide as the number of distinct pattern bytes.  The table is a
+ * full DFA: failure links are folded in at compile time, so the scan loop
+ * is one table lookup per input byte with no backtracking.
+ */
+struct ac {
+    /* patterns, in the order they were added */
+    char **patterns;
+    size_t *lens;
+    uint32_t *next_same;    /* next pattern with the same text, or AC_NONE */
+    size_t npatterns;
+    bool icase;
+
+    /* compiled automaton */
+    uint16_t cls[256];      /* byte -> class */
+    size_t nclasses;
+    size_t nstates;
+    uint32_t *delta;        /* [nstates * nclasses]; entries are premultiplied row offsets */
+    uint32_t *out;          /* per state: pattern that ends here, or AC_NONE */
+    uint32_t *dict;         /* per state: next state on the fail chain with an output */
+    bool has_empty;         /* an empty pattern matches everywhere */
+};
+
+#define AC_NONE UINT32_MAX
+
+void ac_init(struct ac *ac, bool icase);
+void ac_deinit(struct ac *ac);
+
+/* Add a pattern before compiling; return its id. */
+size_t ac_add(struct ac *ac, const char *pattern, size_t len);
+void ac_compile(struct ac *ac);
+
+/*
+ * Return a pointer to the last byte of the first match in [p, p+len), or
+ * NULL if there is none.  For an empty pattern the match is at p.
+ */
+const char *ac_find(const struct ac *ac, const char *p, size_t len);
+
+/*
+ * Call fn(id, arg) for every occurrence of every pattern in [p, p+len).
+ * A pattern that occurs more than once is reported more than once.
+ */
+void ac_foreach(const struct ac *ac, const char *p, size_t len,
+        void (*fn)(size_t id, void *arg), void *arg);
+
+#endif /* _AC_H_ */
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <zlib.h>
+
+#include "decomp.h"
+#include "mu.h"
+#include "xpthread.h"
+
+#define DECOMP_IN_SIZE      (256U << 10)    /* compressed bytes read at a time */
+#define DECOMP_BLOCK_SIZE   (1U << 20)      /* decompressed bytes handed over at a time */
+
+enum decomp_format
+decomp_detect(const void *buf, size_t len)
+{
+    const unsigned char *p = buf;
+
+    if (len >= 2 && p[0] == 0x1f && p[1] == 0x8b)
+        return DECOMP_GZIP;
+
+    if (len >= 4 && p[0] == 0x28 && p[1] == 0xb5 && p[2] == 0x2f && p[3] == 0xfd)
+        return DECOMP_ZSTD;
+
+    return DECOMP_NONE;
+}
+
+/*
+ * Make sure there is compressed input to work on.  Return 1 if there is,
+ * 0 at the end of the input, or a negative errno value.
+ */
+static int
+decomp_fill_in(struct decomp *dc)
+{
+    ssize_t n;
+
+    if (dc->in_off < dc->in_len)
+        return 1;
+
+    if (dc->in_eof)
+        return 0;
+
+    do {
+        n = read(dc->fd, dc->in, dc->in_cap);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1)
+        return -errno;
+
+    dc->in_len = (size_t)n;
+    dc->in_off = 0;
+    if (n == 0)
+        dc->in_eof = true;
+
+    return n > 0;
+}
+
+/*
+ * Decompress into [out, out+cap).  Return the number of bytes produced,
+ * which is less than cap only at the end of the input, or a negative errno
+ * value.
+ *
+ * Concatenated members (cat a.gz b.gz) are decompressed one after another.
+ * Anything after the last member that isn't another member is ignored, as
+ * gzip does.
+ */
+static ssize_t
+gzip_decompress(struct decomp *dc, char *out, size_t cap)
+{
+    z_stream *zs = &dc->zs;
+    int ret;
+
+    zs->next_out = (Bytef *)out;
+    zs->avail_out = (uInt)cap;
+
+    while (zs->avail_out > 0) {
+        ret = decomp_fill_in(dc);
+        if (ret < 0)
+            return ret;
+        if (ret == 0) {
+            if (dc->in_frame)
+                return -EBADMSG;    /* truncated */
+            break;
+        }
+
+        zs->next_in = dc->in + dc->in_off;
+        zs->avail_in = (uInt)(dc->in_len - dc->in_off);
+
+        ret = inflate(zs, Z_NO_FLUSH);
+        dc->in_off = dc->in_len - zs->avail_in;
+
+        if (ret == Z_STREAM_END) {
+            dc->in_frame = false;
+            dc->any_frame = true;
+            inflateReset(zs);
+            continue;
+        }
+
+        if (ret == Z_DATA_ERROR && !dc->in_frame && dc->any_frame) {
+            /* trailing garbage */
+            dc->in_off = dc->in_len;
+            dc->in_eof = true;
+            break;
+        }
+
+        if (ret != Z_OK && ret != Z_BUF_ERROR)
+            return ret == Z_MEM_ERROR ? -ENOMEM : -EBADMSG;
+
+        dc->in_frame = true;
+    }
+
+    return (ssize_t)(cap - zs->avail_out);
+}
+
+#ifdef HAVE_ZSTD
+static ssize_t
+zstd_decompress(struct decomp *dc, char *out, size_t cap)
+{
+    ZSTD_outBuffer ob = {out, cap, 0};
+    ZSTD_inBuffer ib;
+    size_t ret;
+    int n;
+
+    while (ob.pos < ob.size) {
+        n = decomp_fill_in(dc);
+        if (n < 0)
+            return n;
+        if (n == 0) {
+            if (dc->in_frame)
+                return -EBADMSG;
+            break;
+        }
+
+        ib.src = dc->in;
+        ib.size = dc->in_len;
+        ib.pos = dc->in_off;
+
+        ret = ZSTD_decompressStream(dc->zd, &ob, &ib);
+        dc->in_off = ib.pos;
+        if (ZSTD_isError(ret))
+            return -EBADMSG;
+
+        /* 0 means a frame just ended */
+        dc->in_frame = ret != 0;
+    }
+
+    return (ssize_t)ob.pos;
+}
+#endif
+
+static void *
+decomp_producer(void *arg /* decomp */)
+{
+    struct decomp *dc = arg;
+    struct decomp_block *b;
+    ssize_t n;
+    int i = 0;
+
+    for (;;) {
+        b = &dc->blocks[i];
+
+        xpthread_mutex_lock(&dc->lock);
+        while (b->full && !dc->cancel)
+            xpthread_cond_wait(&dc->block_empty, &dc->lock);
+        if (dc->cancel) {
+            xpthread_mutex_unlock(&dc->lock);
+            break;
+        }
+        xpthread_mutex_unlock(&dc->lock);
+
+#ifdef HAVE_ZSTD
+        if (dc->format == DECOMP_ZSTD)
+            n = zstd_decompress(dc, b->data, DECOMP_BLOCK_SIZE);
+        else
+#endif
+            n = gzip_decompress(dc, b->data, DECOMP_BLOCK_SIZE);
+
+        xpthread_mutex_lock(&dc->lock);
+        if (n > 0) {
+            b->len = (size_t)n;
+            b->off = 0;
+            b->full = true;
+        }
+        if (n < 0)
+            dc->err = (int)n;
+        if (n < (ssize_t)DECOMP_BLOCK_SIZE)
+            dc->eof = true;
+        xpthread_cond_signal(&dc->block_full);
+        xpthread_mutex_unlock(&dc->lock);
+
+        if (dc->eof)
+            break;
+
+        i = !i;
+    }
+
+    return NULL;
+}
+
+int
+decomp_open(struct decomp *dc, int fd, enum decomp_format format,
+        const void *head, size_t head_len)
+{
+    int i;
+
+    mu_memzero_p(dc);
+    dc->fd = fd;
+    dc->format = format;
+
+    switch (format) {
+    case DECOMP_GZIP:
+        /* 16: expect a gzip header */
+        if (inflateInit2(&dc->zs, 16 + MAX_WBITS) != Z_OK)
+            return -ENOMEM;
+        break;
+    case DECOMP_ZSTD:
+#ifdef HAVE_ZSTD
+        dc->zd = ZSTD_createDCtx();
+        if (dc->zd == NULL)
+            return -ENOMEM;
+        break;
+#else
+        return -ENOTSUP;
+#endif
+    default:
+        return -EINVAL;
+    }
+
+    /* the bytes already read are the first input */
+    dc->in_cap = head_len > DECOMP_IN_SIZE ? head_len : DECOMP_IN_SIZE;
+    dc->in = mu_mallocarray(dc->in_cap, 1);
+    memcpy(dc->in, head, head_len);
+    dc->in_len = head_len;
+
+    for (i = 0; i < 2; i++)
+        dc->blocks[i].data = mu_mallocarray(DECOMP_BLOCK_SIZE, 1);
+
+    xpthread_mutex_init(&dc->lock, NULL);
+    xpthread_cond_init(&dc->block_full, NULL);
+    xpthread_cond_init(&dc->block_empty, NULL);
+    xpthread_create(&dc->thread, NULL, decomp_producer, dc);
+
+    return 0;
+}
+
+ssize_t
+decomp_read(struct decomp *dc, void *buf, size_t len)
+{
+    struct decomp_block *b = &dc->blocks[dc->cur];
+    bool full;
+    size_t n;
+
+    xpthread_mutex_lock(&dc->lock);
+    while (!b->full && !dc->eof)
+        xpthread_cond_wait(&dc->block_full, &dc->lock);
+    full = b->full;
+    xpthread_mutex_unlock(&dc->lock);
+
+    /* the producer fills the blocks in turn, so if this one is empty, we're done */
+    if (!full)
+        return dc->err;
+
+    n = MU_MIN(len, b->len - b->off);
+    memcpy(buf, b->data + b->off, n);
+    b->off += n;
+
+    if (b->off == b->len) {
+        xpthread_mutex_lock(&dc->lock);
+        b->full = false;
+        xpthread_cond_signal(&dc->block_empty);
+        xpthread_mutex_unlock(&dc->lock);
+        dc->cur = !dc->cur;
+    }
+
+    return (ssize_t)n;
+}
+
+void
+decomp_close(struct decomp *dc)
+{
+    int i;
+
+    xpthread_mutex_lock(&dc->lock);
+    dc->cancel = true;
+    xpthread_cond_signal(&dc->block_empty);
+    xpthread_mutex_unlock(&dc->lock);
+
+    xpthread_join(dc->thread, NULL);
+
+    xpthread_mutex_destroy(&dc->lock);
+    xpthread_cond_destroy(&dc->block_full);
+    xpthread_cond_destroy(&dc->block_empty);
+
+    if (dc->format == DECOMP_GZIP)
+        inflateEnd(&dc->zs);
+#ifdef HAVE_ZSTD
+    else
+        ZSTD_freeDCtx(dc->zd);
+#endif
+
+    for (i = 0; i < 2; i++)
+        free(dc->blocks[i].data);
+    free(dc->in);
+    mu_memzero_p(dc);
+}
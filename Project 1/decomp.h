@@ -0,0 +1,92 @@
+#ifndef _DECOMP_H_
+#define _DECOMP_H_
+
+#include <sys/types.h>
+
+#include <pthread.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include <zlib.h>
+
+#ifdef HAVE_ZSTD
+#   include <zstd.h>
+#endif
+
+/*
+ * Pipelined decompression.  A producer thread reads the compressed input
+ * and decompresses it into one of two blocks while the consumer searches
+ * the other, so decompression and matching overlap.
+ *
+ * gzip is always supported; zstd only when built with HAVE_ZSTD.
+ */
+
+enum decomp_format {
+    DECOMP_NONE,
+    DECOMP_GZIP,
+    DECOMP_ZSTD,
+};
+
+#define DECOMP_MAGIC_LEN 4  /* bytes decomp_detect() needs to see */
+
+struct decomp_block {
+    char *data;
+    size_t len;
+    size_t off;             /* consumer: bytes already taken */
+    bool full;
+};
+
+struct decomp {
+    int fd;
+    enum decomp_format format;
+
+    /* producer-only state */
+    unsigned char *in;
+    size_t in_cap;
+    size_t in_len;
+    size_t in_off;
+    bool in_eof;
+    bool in_frame;          /* in the middle of a gzip member or zstd frame */
+    bool any_frame;         /* a whole member or frame was decompressed */
+    z_stream zs;
+#ifdef HAVE_ZSTD
+    ZSTD_DCtx *zd;
+#endif
+
+    struct decomp_block blocks[2];
+    int cur;                /* consumer's block */
+    bool eof;               /* the producer is done; no more blocks will fill */
+    bool cancel;            /* the consumer is done early */
+    int err;                /* the producer's error, as a negative errno */
+
+    pthread_mutex_t lock;
+    pthread_cond_t block_full;
+    pthread_cond_t block_empty;
+    pthread_t thread;
+};
+
+/* Return the format of data that starts with [buf, buf+len). */
+enum decomp_format decomp_detect(const void *buf, size_t len);
+
+/*
+ * Start decompressing fd in a producer thread.  head holds bytes already
+ * read from fd, which are decompressed first.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value (-ENOTSUP for a format this
+ * build doesn't support).
+ */
+int decomp_open(struct decomp *dc, int fd, enum decomp_format format,
+        const void *head, size_t head_len);
+
+/*
+ * Copy up to len bytes of decompressed data into buf, like read(2).
+ * Return the number of bytes copied, 0 at the end of the input, or a
+ * negative errno value (-EBADMSG for corrupt or truncated input).
+ */
+ssize_t decomp_read(struct decomp *dc, void *buf, size_t len);
+
+/* Stop the producer, which may not have reached the end, and free everything. */
+void decomp_close(struct decomp *dc);
+
+#endif /* _DECOMP_H_ */
@@ -0,0 +1,221 @@
+/*
+ * gencorpus: write a synthetic log-like corpus for benchmarking sgrep.
+ *
+ * The output is deterministic: the same options and seed always give the
+ * same bytes, so timings from different builds are comparable.
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mu.h"
+
+#define USAGE \
+    "Usage: gencorpus [-s SIZE] [-l LINE_LEN] [-d DENSITY] [-p STR] [-S SEED]\n" \
+    "\n" \
+    "Write about SIZE bytes of text to stdout, in lines of LINE_LEN bytes on average.\n" \
+    "A fraction DENSITY of the lines contain STR (which can't contain a space); no other\n" \
+    "line does, even ignoring case.\n" \
+    "\n" \
+    "   -s SIZE       bytes to write, with an optional K, M or G suffix (default 64M)\n" \
+    "   -l LINE_LEN   average line length, including the newline (default 80)\n" \
+    "   -d DENSITY    fraction of lines holding STR, from 0 to 1 (default 0.01)\n" \
+    "   -p STR        the string to plant (default \"needle\")\n" \
+    "   -S SEED       random seed (default 1)\n"
+
+#define GEN_BUF_SIZE (1U << 20)
+
+static const char *words[] = {
+    "alpha", "beta", "gamma", "delta", "info", "warn", "error", "debug",
+    "user", "session", "request", "response", "latency", "cache", "miss", "hit",
+    "GET", "POST", "200", "404", "500", "ms", "id=", "path=/api/v1",
+    "retry", "timeout", "upstream", "worker", "queue", "shard", "token", "OK",
+};
+
+/* splitmix64: small, fast, and the same everywhere */
+static uint64_t
+rng_next(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Return a number in [0, n). */
+static size_t
+rng_below(uint64_t *state, size_t n)
+{
+    return (size_t)(rng_next(state) % n);
+}
+
+static int
+parse_size(const char *s, size_t *size)
+{
+    char *end;
+    unsigned long long n;
+
+    errno = 0;
+    n = strtoull(s, &end, 10);
+    if (errno != 0 || end == s)
+        return -EINVAL;
+
+    switch (*end) {
+    case 'G': case 'g': n <<= 10;   /* fall through */
+    case 'M': case 'm': n <<= 10;   /* fall through */
+    case 'K': case 'k': n <<= 10; end++; break;
+    default: break;
+    }
+
+    if (*end != '\0')
+        return -EINVAL;
+
+    *size = (size_t)n;
+    return 0;
+}
+
+struct gen {
+    char *buf;
+    size_t len;
+    size_t written;
+};
+
+static void
+gen_put(struct gen *g, const char *p, size_t n)
+{
+    int ret;
+
+    if (GEN_BUF_SIZE - g->len < n) {
+        ret = mu_write_n(STDOUT_FILENO, g->buf, g->len, NULL);
+        if (ret != 0)
+            mu_die_errno(-ret, "gencorpus: write");
+        g->len = 0;
+    }
+
+    memcpy(g->buf + g->len, p, n);
+    g->len += n;
+    g->written += n;
+}
+
+/*
+ * Write one line of about len bytes (newline included), made of random
+ * words.  With needle, plant it after a random word.
+ */
+static void
+gen_line(struct gen *g, uint64_t *rng, size_t len, const char *needle)
+{
+    size_t n = 0, at = SIZE_MAX, nwords = 0, w;
+    const char *word;
+
+    if (needle != NULL)
+        at = rng_below(rng, len / 8 + 1);
+
+    while (n + 1 < len) {
+        if (nwords == at) {
+            gen_put(g, needle, strlen(needle));
+            gen_put(g, " ", 1);
+            n += strlen(needle) + 1;
+        }
+
+        word = words[rng_below(rng, sizeof(words) / sizeof(words[0]))];
+        w = strlen(word);
+        gen_put(g, word, w);
+        gen_put(g, " ", 1);
+        n += w + 1;
+        nwords++;
+    }
+
+    /* the line was too short to reach the spot */
+    if (needle != NULL && nwords <= at) {
+        gen_put(g, needle, strlen(needle));
+        gen_put(g, " ", 1);
+    }
+
+    gen_put(g, "\n", 1);
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t size = 64U << 20, line_len = 80, len;
+    double density = 0.01;
+    const char *needle = "needle";
+    uint64_t rng = 1, threshold;
+    struct gen g;
+    char *end;
+    int opt, ret;
+
+    while ((opt = getopt(argc, argv, ":s:l:d:p:S:h")) != -1) {
+        switch (opt) {
+        case 's':
+            if (parse_size(optarg, &size) != 0)
+                mu_die("gencorpus: invalid size \"%s\"", optarg);
+            break;
+        case 'l':
+            if (parse_size(optarg, &line_len) != 0 || line_len < 2)
+                mu_die("gencorpus: invalid line length \"%s\"", optarg);
+            break;
+        case 'd':
+            errno = 0;
+            density = strtod(optarg, &end);
+            if (errno != 0 || *end != '\0' || !(density >= 0 && density <= 1))
+                mu_die("gencorpus: invalid density \"%s\"", optarg);
+            break;
+        case 'p':
+            needle = optarg;
+            break;
+        case 'S':
+            errno = 0;
+            rng = strtoull(optarg, &end, 10);
+            if (errno != 0 || *end != '\0')
+                mu_die("gencorpus: invalid seed \"%s\"", optarg);
+            break;
+        case 'h':
+            fputs(USAGE, stdout);
+            return 0;
+        default:
+            fputs(USAGE, stderr);
+            return 1;
+        }
+    }
+
+    /* words are separated by spaces, so without one STR can't span two */
+    if (needle[0] == '\0' || strpbrk(needle, " \n") != NULL)
+        mu_die("gencorpus: STR must be a non-empty string without spaces or newlines");
+
+    /* and no word can contain it, or a line without it might */
+    for (len = 0; len < sizeof(words) / sizeof(words[0]); len++) {
+        if (strcasestr(words[len], needle) != NULL)
+            mu_die("gencorpus: STR \"%s\" occurs in the word \"%s\"", needle, words[len]);
+    }
+
+    threshold = density >= 1 ? UINT64_MAX : (uint64_t)(density * (double)UINT64_MAX);
+
+    memset(&g, 0, sizeof(g));
+    g.buf = mu_mallocarray(GEN_BUF_SIZE, 1);
+
+    while (g.written < size) {
+        /* line lengths vary uniformly from half to one and a half times the average */
+        len = line_len / 2 + rng_below(&rng, line_len + 1);
+        len = MU_MIN(len, size - g.written);
+        if (len < 2)
+            len = 2;
+        gen_line(&g, &rng, len, rng_next(&rng) < threshold ? needle : NULL);
+    }
+
+    ret = mu_write_n(STDOUT_FILENO, g.buf, g.len, NULL);
+    if (ret != 0)
+        mu_die_errno(-ret, "gencorpus: write");
+
+    free(g.buf);
+    return 0;
+}
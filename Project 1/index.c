@@ -0,0 +1,316 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "mu.h"
+
+#define INDEX_MAGIC "SGRPIDX1"
+
+static inline unsigned char
+fold(unsigned char c)
+{
+    return (unsigned char)(c - 'A') < 26 ? c | 0x20 : c;
+}
+
+_Static_assert(INDEX_TRIGRAM_BITS == 1U << 15, "trigram_bit() makes 15-bit numbers");
+
+/* The bit for a trigram, packed into the low 24 bits of t: the top 15 bits of its hash. */
+static inline uint32_t
+trigram_bit(uint32_t t)
+{
+    return (t * 0x9e3779b1U) >> (32 - 15);
+}
+
+static inline bool
+bitmap_test(const uint8_t *map, uint32_t bit)
+{
+    return map[bit >> 3] & (1U << (bit & 7));
+}
+
+static size_t
+count_lines(const char *p, const char *end)
+{
+    size_t n = 0;
+
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        n++;
+        p++;
+    }
+
+    return n;
+}
+
+static size_t
+trigram_map_size(size_t nblocks)
+{
+    return nblocks * (INDEX_TRIGRAM_BITS / 8);
+}
+
+/* Fill in everything in the header but the counts. */
+static int
+index_header_init(struct index_header *hdr, int fd)
+{
+    struct stat st;
+
+    if (fstat(fd, &st) == -1)
+        return -errno;
+
+    mu_memzero_p(hdr);
+    memcpy(hdr->magic, INDEX_MAGIC, sizeof(hdr->magic));
+    hdr->k = INDEX_K;
+    hdr->block_size = INDEX_BLOCK_SIZE;
+    hdr->trigram_bits = INDEX_TRIGRAM_BITS;
+    hdr->size = (uint64_t)st.st_size;
+    hdr->mtime_sec = st.st_mtim.tv_sec;
+    hdr->mtime_nsec = st.st_mtim.tv_nsec;
+
+    return 0;
+}
+
+static char *
+sidecar_path(const char *path)
+{
+    size_t len = strlen(path);
+    char *s;
+
+    s = mu_mallocarray(len + sizeof(INDEX_SUFFIX), 1);
+    memcpy(s, path, len);
+    memcpy(s + len, INDEX_SUFFIX, sizeof(INDEX_SUFFIX));
+
+    return s;
+}
+
+int
+index_load(struct index *ix, const char *path, int fd)
+{
+    struct index_header want;
+    const struct index_header *hdr;
+    struct stat st;
+    char *sidecar;
+    void *map;
+    size_t len;
+    int ret, sfd;
+
+    mu_memzero_p(ix);
+
+    ret = index_header_init(&want, fd);
+    if (ret != 0)
+        return ret;
+
+    sidecar = sidecar_path(path);
+    sfd = open(sidecar, O_RDONLY);
+    free(sidecar);
+    if (sfd == -1)
+        return -errno;
+
+    if (fstat(sfd, &st) == -1) {
+        ret = -errno;
+        close(sfd);
+        return ret;
+    }
+
+    len = (size_t)st.st_size;
+    if (len < sizeof(*hdr)) {
+        close(sfd);
+        return -ESTALE;
+    }
+
+    map = mmap(NULL, len, PROT_READ, MAP_PRIVATE, sfd, 0);
+    ret = map == MAP_FAILED ? -errno : 0;
+    close(sfd);
+    if (ret != 0)
+        return ret;
+
+    /* everything but the counts must match, and the counts must fit the file */
+    hdr = map;
+    if (memcmp(hdr, &want, offsetof(struct index_header, noffsets)) != 0 ||
+            hdr->noffsets == 0 ||
+            hdr->noffsets > (len - sizeof(*hdr)) / sizeof(uint64_t) ||
+            hdr->nblocks != (hdr->size + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE ||
+            len != sizeof(*hdr) + hdr->noffsets * sizeof(uint64_t) +
+                    trigram_map_size(hdr->nblocks)) {
+        munmap(map, len);
+        return -ESTALE;
+    }
+
+    ix->hdr = *hdr;
+    ix->offsets = (const uint64_t *)(hdr + 1);
+    ix->trigrams = (const uint8_t *)(ix->offsets + hdr->noffsets);
+    ix->map = map;
+    ix->map_len = len;
+
+    return 0;
+}
+
+int
+index_build(struct index *ix, int fd, const char *buf, size_t size)
+{
+    const char *p = buf, *end = buf + size, *nl;
+    uint64_t *offsets;
+    uint8_t *map;
+    size_t noffsets = 1, cap = 64, lines = 0, b, i, stop;
+    uint32_t t, bit;
+    int ret;
+
+    mu_memzero_p(ix);
+
+    ret = index_header_init(&ix->hdr, fd);
+    if (ret != 0)
+        return ret;
+
+    /* the file may have changed since it was mapped */
+    if (ix->hdr.size != size)
+        return -ESTALE;
+
+    offsets = mu_mallocarray(cap, sizeof(*offsets));
+    offsets[0] = 0;
+    while ((nl = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        p = nl + 1;
+        if (++lines % INDEX_K != 0)
+            continue;
+
+        if (noffsets == cap) {
+            cap *= 2;
+            offsets = mu_reallocarray(offsets, cap, sizeof(*offsets));
+        }
+        offsets[noffsets++] = (uint64_t)(p - buf);
+    }
+
+    /*
+     * A trigram belongs to the block it starts in, even if it ends in the
+     * next one.  The last two bytes of the file start no trigram.
+     */
+    ix->hdr.nblocks = (size + INDEX_BLOCK_SIZE - 1) / INDEX_BLOCK_SIZE;
+    map = mu_calloc(trigram_map_size(ix->hdr.nblocks), 1);
+    for (b = 0; b < ix->hdr.nblocks && size >= 3; b++) {
+        i = b * INDEX_BLOCK_SIZE;
+        stop = MU_MIN(i + INDEX_BLOCK_SIZE, size - 2);
+        t = (uint32_t)fold((unsigned char)buf[i]) << 8 | fold((unsigned char)buf[i + 1]);
+        for (; i < stop; i++) {
+            t = (t << 8 | fold((unsigned char)buf[i + 2])) & 0xffffff;
+            bit = trigram_bit(t);
+            map[b * (INDEX_TRIGRAM_BITS / 8) + (bit >> 3)] |= (uint8_t)(1U << (bit & 7));
+        }
+    }
+
+    ix->hdr.noffsets = noffsets;
+    ix->offsets = ix->mem_offsets = offsets;
+    ix->trigrams = ix->mem_trigrams = map;
+
+    return 0;
+}
+
+int
+index_save(const struct index *ix, const char *path)
+{
+    struct stat st;
+    char *sidecar, *tmp;
+    size_t len;
+    int fd, ret;
+
+    sidecar = sidecar_path(path);
+    len = strlen(sidecar);
+    tmp = mu_mallocarray(len + sizeof(".XXXXXX"), 1);
+    memcpy(tmp, sidecar, len);
+    memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    fd = mkstemp(tmp);
+    if (fd == -1) {
+        ret = -errno;
+        goto out;
+    }
+
+    /* whoever may read the file may read its index (mkstemp makes it 0600) */
+    if (stat(path, &st) == 0)
+        (void)fchmod(fd, st.st_mode & 0666);
+
+    ret = mu_write_n(fd, &ix->hdr, sizeof(ix->hdr), NULL);
+    if (ret == 0)
+        ret = mu_write_n(fd, ix->offsets, ix->hdr.noffsets * sizeof(*ix->offsets), NULL);
+    if (ret == 0)
+        ret = mu_write_n(fd, ix->trigrams, trigram_map_size(ix->hdr.nblocks), NULL);
+    if (close(fd) == -1 && ret == 0)
+        ret = -errno;
+    if (ret == 0 && rename(tmp, sidecar) == -1)
+        ret = -errno;
+    if (ret != 0)
+        unlink(tmp);
+
+out:
+    free(tmp);
+    free(sidecar);
+    return ret;
+}
+
+void
+index_close(struct index *ix)
+{
+    if (ix->map != NULL)
+        munmap(ix->map, ix->map_len);
+    free(ix->mem_offsets);
+    free(ix->mem_trigrams);
+    mu_memzero_p(ix);
+}
+
+size_t
+index_count_lines(const struct index *ix, const char *base, const char *p,
+        const char *q, size_t n)
+{
+    uint64_t off = (uint64_t)(q - base);
+    size_t lo = 0, hi = ix->hdr.noffsets, mid;
+    const char *e;
+
+    /* the last entry at or before q */
+    while (hi - lo > 1) {
+        mid = lo + (hi - lo) / 2;
+        if (ix->offsets[mid] <= off)
+            lo = mid;
+        else
+            hi = mid;
+    }
+
+    /* count from the entry or from p, whichever is closer */
+    e = base + ix->offsets[lo];
+    if (e > p)
+        return lo * INDEX_K + count_lines(e, q);
+
+    return n + count_lines(p, q);
+}
+
+bool
+index_block_may_contain(const struct index *ix, size_t block,
+        const char *needle, size_t len)
+{
+    const uint8_t *map = ix->trigrams + block * (INDEX_TRIGRAM_BITS / 8);
+    const uint8_t *next = NULL;
+    uint32_t t, bit;
+    size_t i;
+
+    if (len < 3 || len > INDEX_BLOCK_SIZE)
+        return true;
+
+    /* an occurrence near the end of the block has its last trigrams in the next */
+    if (block + 1 < ix->hdr.nblocks)
+        next = map + INDEX_TRIGRAM_BITS / 8;
+
+    t = (uint32_t)fold((unsigned char)needle[0]) << 8 | fold((unsigned char)needle[1]);
+    for (i = 2; i < len; i++) {
+        t = (t << 8 | fold((unsigned char)needle[i])) & 0xffffff;
+        bit = trigram_bit(t);
+        if (!bitmap_test(map, bit) && (next == NULL || !bitmap_test(next, bit)))
+            return false;
+    }
+
+    return true;
+}
@@ -0,0 +1,94 @@
+#ifndef _INDEX_H_
+#define _INDEX_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * A sidecar index for a file that is searched again and again, kept in
+ * FILE.sgrepidx and keyed by the file's size and mtime.  It holds:
+ *
+ *  - the byte offset of every INDEX_K-th line, so the number of the line
+ *    at any offset is a binary search plus a count of at most INDEX_K
+ *    lines, rather than a count from the start of the file;
+ *
+ *  - for each block of INDEX_BLOCK_SIZE bytes, a bitmap of the (hashed,
+ *    case-folded) trigrams that start in it, so a search can skip the
+ *    blocks that can't contain the string it's looking for.
+ */
+
+#define INDEX_SUFFIX        ".sgrepidx"
+#define INDEX_K             1024
+#define INDEX_BLOCK_SIZE    (64U << 10)
+#define INDEX_TRIGRAM_BITS  (1U << 15)
+
+/* The start of the sidecar; the offsets and then the bitmaps follow. */
+struct index_header {
+    char magic[8];
+    uint32_t k;
+    uint32_t block_size;
+    uint32_t trigram_bits;
+    uint32_t reserved;
+    uint64_t size;              /* the indexed file's size and mtime */
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+    uint64_t noffsets;
+    uint64_t nblocks;
+};
+
+struct index {
+    struct index_header hdr;
+    const uint64_t *offsets;    /* offsets[i] is where line i*INDEX_K+1 starts */
+    const uint8_t *trigrams;    /* nblocks bitmaps of INDEX_TRIGRAM_BITS */
+
+    void *map;                  /* the sidecar, if the index was loaded */
+    size_t map_len;
+    uint64_t *mem_offsets;      /* or the tables, if it was built */
+    uint8_t *mem_trigrams;
+};
+
+/*
+ * Load the index for path, which is open as fd.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value; -ESTALE if the sidecar is for
+ * another version of the file.
+ */
+int index_load(struct index *ix, const char *path, int fd);
+
+/*
+ * Build the index for fd, which is mapped at [buf, buf+size).
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+int index_build(struct index *ix, int fd, const char *buf, size_t size);
+
+/*
+ * Save a built index as the sidecar for path.  The sidecar is replaced
+ * atomically, so a concurrent search never sees half of one.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+int index_save(const struct index *ix, const char *path);
+
+void index_close(struct index *ix);
+
+/*
+ * Return the number of newlines in [base, q), given that there are n in
+ * [base, p) and p <= q.  base is the start of the file.
+ */
+size_t index_count_lines(const struct index *ix, const char *base, const char *p,
+        const char *q, size_t n);
+
+/*
+ * Return false if no occurrence of needle (ignoring ASCII case) can start
+ * in the given block.  Needles shorter than a trigram, or longer than a
+ * block, may start anywhere.
+ */
+bool index_block_may_contain(const struct index *ix, size_t block,
+        const char *needle, size_t len);
+
+#endif /* _INDEX_H_ */
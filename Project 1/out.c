@@ -0,0 +1,168 @@
+#define _GNU_SOURCE
+
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mu.h"
+#include "out.h"
+
+#define OUT_BUF_SIZE    (1U << 20)  /* staging buffer when writing to a file descriptor */
+#define OUT_MEM_SIZE    4096        /* initial buffer when collecting in memory */
+#define OUT_IOV_MAX     1024        /* IOV_MAX on Linux */
+#define OUT_COPY_MAX    256         /* lines shorter than this are copied; an iovec costs more */
+
+void
+out_init(struct out *out, int fd)
+{
+    mu_memzero_p(out);
+    out->fd = fd;
+    out->cap = fd < 0 ? OUT_MEM_SIZE : OUT_BUF_SIZE;
+    out->buf = mu_mallocarray(out->cap, 1);
+    if (fd >= 0)
+        out->iov = mu_mallocarray(OUT_IOV_MAX, sizeof(*out->iov));
+}
+
+void
+out_deinit(struct out *out)
+{
+    free(out->buf);
+    free(out->iov);
+    mu_memzero_p(out);
+}
+
+void
+out_reset(struct out *out)
+{
+    out->len = 0;
+    out->seg = 0;
+    out->niov = 0;
+}
+
+/* Queue the staged bytes that aren't in an iovec yet. */
+static void
+out_close_seg(struct out *out)
+{
+    if (out->len == out->seg)
+        return;
+
+    out->iov[out->niov].iov_base = out->buf + out->seg;
+    out->iov[out->niov].iov_len = out->len - out->seg;
+    out->niov++;
+    out->seg = out->len;
+}
+
+static int
+out_writev(struct out *out, struct iovec *iov, size_t niov)
+{
+    ssize_t n;
+    size_t k;
+
+    while (niov > 0) {
+        n = writev(out->fd, iov, (int)niov);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+
+        /* skip what was written, which may end partway into an iovec */
+        for (k = (size_t)n; niov > 0 && k >= iov->iov_len; niov--)
+            k -= (iov++)->iov_len;
+
+        if (niov > 0) {
+            iov->iov_base = (char *)iov->iov_base + k;
+            iov->iov_len -= k;
+        }
+    }
+
+    return 0;
+}
+
+int
+out_flush(struct out *out)
+{
+    int ret;
+
+    if (out->fd < 0)
+        return out->err;
+
+    out_close_seg(out);
+
+    /* after an error, output is dropped so the error is reported once, at the end */
+    if (out->err == 0 && out->niov > 0) {
+        ret = out_writev(out, out->iov, out->niov);
+        if (ret != 0)
+            out->err = ret;
+    }
+
+    out_reset(out);
+
+    return out->err;
+}
+
+void
+out_bytes(struct out *out, const void *p, size_t len)
+{
+    int ret;
+
+    if (out->cap - out->len < len) {
+        if (out->fd < 0) {
+            while (out->cap - out->len < len)
+                out->cap *= 2;
+            out->buf = mu_realloc(out->buf, out->cap);
+        } else {
+            out_flush(out);
+            if (len > out->cap) {
+                /* too big to stage: write it straight through */
+                ret = out->err != 0 ? 0 : mu_write_n(out->fd, p, len, NULL);
+                if (ret != 0)
+                    out->err = ret;
+                return;
+            }
+        }
+    }
+
+    memcpy(out->buf + out->len, p, len);
+    out->len += len;
+}
+
+void
+out_ref(struct out *out, const void *p, size_t len)
+{
+    if (out->fd < 0 || len < OUT_COPY_MAX) {
+        out_bytes(out, p, len);
+        return;
+    }
+
+    if (out->niov + 2 > OUT_IOV_MAX)
+        out_flush(out);
+
+    out_close_seg(out);
+    out->iov[out->niov].iov_base = (void *)p;
+    out->iov[out->niov].iov_len = len;
+    out->niov++;
+}
+
+void
+out_str(struct out *out, const char *s)
+{
+    out_bytes(out, s, strlen(s));
+}
+
+void
+out_num(struct out *out, size_t n)
+{
+    char tmp[20], *p = tmp + sizeof(tmp);
+
+    do {
+        *--p = (char)('0' + n % 10);
+        n /= 10;
+    } while (n != 0);
+
+    out_bytes(out, p, (size_t)(tmp + sizeof(tmp) - p));
+}
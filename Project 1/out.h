@@ -0,0 +1,60 @@
+#ifndef _OUT_H_
+#define _OUT_H_
+
+#include <sys/uio.h>
+
+#include <stddef.h>
+
+/*
+ * Buffered output.  Selected lines are not copied: out_ref() queues an
+ * iovec pointing into the input, and the small pieces around the lines
+ * (file names, line numbers, separators) are copied into a staging buffer.
+ * Nothing is written until the staging buffer or the iovec array fills up,
+ * or out_flush() is called; then everything goes out in one writev.
+ *
+ * Since queued lines point into the input, the caller must flush before
+ * the input is unmapped or overwritten.
+ *
+ * With an fd of -1, the output is collected in memory instead: the
+ * buffer grows as needed, and out_ref() copies.
+ */
+struct out {
+    int fd;
+    char *buf;              /* staging buffer */
+    size_t len;
+    size_t cap;
+    size_t seg;             /* start of the staged bytes not yet in iov */
+    struct iovec *iov;
+    size_t niov;
+    int err;                /* first write error, as a negative errno */
+};
+
+void out_init(struct out *out, int fd);
+void out_deinit(struct out *out);
+
+/* Forget anything not yet written. */
+void out_reset(struct out *out);
+
+void out_bytes(struct out *out, const void *p, size_t len);
+void out_ref(struct out *out, const void *p, size_t len);
+void out_str(struct out *out, const char *s);
+void out_num(struct out *out, size_t n);
+
+static inline void
+out_char(struct out *out, char c)
+{
+    if (out->len < out->cap)
+        out->buf[out->len++] = c;
+    else
+        out_bytes(out, &c, 1);
+}
+
+/*
+ * Write everything queued.
+ *
+ * On success, return 0.
+ * On failure, return the first write error as a negative errno value.
+ */
+int out_flush(struct out *out);
+
+#endif /* _OUT_H_ */
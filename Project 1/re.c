@@ -0,0 +1,1262 @@
+#define _GNU_SOURCE
+
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "ac.h"
+#include "mu.h"
+#include "re.h"
+#include "search.h"
+
+enum {
+    RE_SET,         /* consume a byte in sets[x] */
+    RE_JMP,         /* continue at x */
+    RE_SPLIT,       /* continue at both x and y */
+    RE_BOL,         /* only at the start of a line */
+    RE_EOL,         /* only at the end of a line */
+    RE_MATCH,       /* always the last instruction */
+};
+
+#define RE_DUP_MAX      255         /* largest count allowed in {m,n} */
+#define RE_MAX_PROG     (1U << 16)  /* longest program we compile */
+#define RE_MAX_LITS     32          /* most literals the prefilter looks for */
+#define RE_CACHE_SIZE   (2U << 20)  /* memory for DFA states before the cache is flushed */
+
+/*
+ * DFA transitions are the index of the next state, with the top bit set
+ * when that state is a match, so the search loop needs only the one load.
+ */
+#define DFA_MATCH       (1U << 31)
+#define DFA_INDEX       (~DFA_MATCH)
+#define DFA_UNKNOWN     UINT32_MAX
+
+struct re_state {
+    uint32_t *pcs;      /* sorted positions of the RE_SET, RE_EOL and RE_MATCH instructions */
+    size_t npcs;
+    uint32_t hash;
+    bool match_eol;     /* the state is a match if the line ends here */
+    uint32_t *next;     /* per byte class: the next state, or DFA_UNKNOWN */
+};
+
+static inline void
+bit_set(uint64_t *bits, unsigned int c)
+{
+    bits[c >> 6] |= 1ULL << (c & 63);
+}
+
+static inline void
+bit_clear(uint64_t *bits, unsigned int c)
+{
+    bits[c >> 6] &= ~(1ULL << (c & 63));
+}
+
+static inline bool
+bit_test(const uint64_t *bits, unsigned int c)
+{
+    return (bits[c >> 6] >> (c & 63)) & 1;
+}
+
+/* Make the set closed under ASCII case. */
+static void
+bits_fold(uint64_t *bits)
+{
+    unsigned int c;
+
+    for (c = 'a'; c <= 'z'; c++) {
+        if (bit_test(bits, c) || bit_test(bits, c - 0x20)) {
+            bit_set(bits, c);
+            bit_set(bits, c - 0x20);
+        }
+    }
+}
+
+/*
+ * The parser builds a syntax tree, which is compiled to the program and
+ * also searched for the literals that every match must contain.
+ */
+
+enum { N_EMPTY, N_LIT, N_SET, N_BOL, N_EOL, N_CAT, N_ALT, N_REPEAT };
+
+struct node {
+    int type;
+    unsigned char c;    /* N_LIT */
+    uint32_t set;       /* N_SET */
+    int a, b;           /* children */
+    int min, max;       /* N_REPEAT; max is -1 when unbounded */
+};
+
+struct parser {
+    struct re *re;
+    const char *p;
+    const char *end;
+    int depth;          /* open parentheses */
+    struct node *nodes;
+    size_t nnodes;
+    size_t cap;
+    const char *err;
+};
+
+static int parse_alt(struct parser *ps);
+
+static int
+new_node(struct parser *ps, int type, int a, int b)
+{
+    struct node *n;
+
+    if (ps->nnodes == ps->cap) {
+        ps->cap = ps->cap == 0 ? 64 : ps->cap * 2;
+        ps->nodes = mu_reallocarray(ps->nodes, ps->cap, sizeof(*ps->nodes));
+    }
+
+    n = &ps->nodes[ps->nnodes];
+    memset(n, 0, sizeof(*n));
+    n->type = type;
+    n->a = a;
+    n->b = b;
+
+    return (int)ps->nnodes++;
+}
+
+static uint32_t
+re_add_set(struct re *re, const uint64_t *bits)
+{
+    re->sets = mu_reallocarray(re->sets, re->nsets + 1, sizeof(*re->sets));
+    memcpy(re->sets[re->nsets], bits, sizeof(*re->sets));
+
+    return (uint32_t)re->nsets++;
+}
+
+static int
+new_set(struct parser *ps, uint64_t *bits)
+{
+    int i;
+
+    if (ps->re->icase)
+        bits_fold(bits);
+
+    i = new_node(ps, N_SET, -1, -1);
+    ps->nodes[i].set = re_add_set(ps->re, bits);
+
+    return i;
+}
+
+/* Add the bytes in the named class (e.g., "alpha") to bits.  Return false if there is no such class. */
+static bool
+add_class(uint64_t *bits, const char *name, size_t len)
+{
+    static const struct {
+        const char *name;
+        int (*fn)(int);
+    } classes[] = {
+        {"alnum", isalnum}, {"alpha", isalpha}, {"blank", isblank},
+        {"cntrl", iscntrl}, {"digit", isdigit}, {"graph", isgraph},
+        {"lower", islower}, {"print", isprint}, {"punct", ispunct},
+        {"space", isspace}, {"upper", isupper}, {"xdigit", isxdigit},
+    };
+    size_t i;
+    unsigned int c;
+
+    for (i = 0; i < sizeof(classes) / sizeof(classes[0]); i++) {
+        if (strlen(classes[i].name) != len || memcmp(classes[i].name, name, len) != 0)
+            continue;
+
+        for (c = 0; c < 256; c++) {
+            if (classes[i].fn((int)c))
+                bit_set(bits, c);
+        }
+        return true;
+    }
+
+    return false;
+}
+
+/* Parse a bracket expression; ps->p is just past the '['. */
+static int
+parse_bracket(struct parser *ps)
+{
+    uint64_t bits[4] = {0, 0, 0, 0};
+    bool negate = false, first = true;
+    unsigned int c, lo, hi;
+    const char *q;
+    int i;
+
+    if (ps->p < ps->end && *ps->p == '^') {
+        negate = true;
+        ps->p++;
+    }
+
+    for (;;) {
+        if (ps->p == ps->end) {
+            ps->err = "unmatched [";
+            return -1;
+        }
+
+        /* a ']' first in the list is an ordinary character */
+        if (*ps->p == ']' && !first) {
+            ps->p++;
+            break;
+        }
+        first = false;
+
+        if (*ps->p == '[' && ps->end - ps->p > 1 && ps->p[1] == ':') {
+            q = memmem(ps->p + 2, (size_t)(ps->end - ps->p - 2), ":]", 2);
+            if (q == NULL || !add_class(bits, ps->p + 2, (size_t)(q - ps->p - 2))) {
+                ps->err = "invalid character class";
+                return -1;
+            }
+            ps->p = q + 2;
+            continue;
+        }
+
+        if (*ps->p == '[' && ps->end - ps->p > 1 && (ps->p[1] == '=' || ps->p[1] == '.')) {
+            /* only single-byte collating elements and equivalence classes */
+            if (ps->end - ps->p < 5 || ps->p[3] != ps->p[1] || ps->p[4] != ']') {
+                ps->err = "unsupported collating element";
+                return -1;
+            }
+            lo = (unsigned char)ps->p[2];
+            ps->p += 5;
+        } else {
+            lo = (unsigned char)*ps->p++;
+        }
+
+        hi = lo;
+        if (ps->end - ps->p > 1 && ps->p[0] == '-' && ps->p[1] != ']') {
+            hi = (unsigned char)ps->p[1];
+            ps->p += 2;
+            if (hi < lo) {
+                ps->err = "invalid range end";
+                return -1;
+            }
+        }
+
+        for (c = lo; c <= hi; c++)
+            bit_set(bits, c);
+    }
+
+    /* fold before negating, so [^a] excludes 'A' too */
+    if (ps->re->icase)
+        bits_fold(bits);
+
+    if (negate) {
+        for (i = 0; i < 4; i++)
+            bits[i] = ~bits[i];
+        bit_clear(bits, '\n');
+    }
+
+    return new_set(ps, bits);
+}
+
+/* \w, \s, \d and their complements */
+static int
+parse_escape_class(struct parser *ps, unsigned char c)
+{
+    uint64_t bits[4] = {0, 0, 0, 0};
+    int i;
+
+    switch (tolower(c)) {
+    case 'w':
+        add_class(bits, "alnum", 5);
+        bit_set(bits, '_');
+        break;
+    case 's':
+        add_class(bits, "space", 5);
+        break;
+    case 'd':
+        add_class(bits, "digit", 5);
+        break;
+    }
+
+    if (isupper(c)) {
+        for (i = 0; i < 4; i++)
+            bits[i] = ~bits[i];
+        bit_clear(bits, '\n');
+    }
+
+    return new_set(ps, bits);
+}
+
+static int
+parse_atom(struct parser *ps)
+{
+    uint64_t bits[4];
+    unsigned char c;
+    int a;
+
+    c = (unsigned char)*ps->p++;
+
+    switch (c) {
+    case '(':
+        ps->depth++;
+        a = parse_alt(ps);
+        if (a < 0)
+            return -1;
+        if (ps->p == ps->end || *ps->p != ')') {
+            ps->err = "unmatched (";
+            return -1;
+        }
+        ps->p++;
+        ps->depth--;
+        return a;
+    case '[':
+        return parse_bracket(ps);
+    case '.':
+        memset(bits, 0xff, sizeof(bits));
+        bit_clear(bits, '\n');
+        return new_set(ps, bits);
+    case '^':
+        return new_node(ps, N_BOL, -1, -1);
+    case '$':
+        return new_node(ps, N_EOL, -1, -1);
+    case '\\':
+        if (ps->p == ps->end) {
+            ps->err = "trailing backslash";
+            return -1;
+        }
+        c = (unsigned char)*ps->p++;
+        if (c != '\0' && strchr("wWsSdD", c) != NULL)
+            return parse_escape_class(ps, c);
+        /* only escaped punctuation is literal; \b, \< and the like aren't supported */
+        if (isalnum(c) || c == '<' || c == '>') {
+            ps->err = "unsupported escape";
+            return -1;
+        }
+        break;
+    }
+
+    /* anything else, including a '*' or '{' with nothing to repeat, is itself */
+    a = new_node(ps, N_LIT, -1, -1);
+    ps->nodes[a].c = c;
+
+    return a;
+}
+
+/*
+ * Parse "{m}", "{m,}" or "{m,n}" at ps->p.  Return 1 if there is one, 0 if
+ * the '{' doesn't start a bound (and so is an ordinary character), and -1
+ * on error.
+ */
+static int
+parse_bound(struct parser *ps, int *min, int *max)
+{
+    const char *p = ps->p + 1;
+    long lo = 0, hi;
+
+    /* "{,n}" is "{0,n}", as in GNU grep */
+    if (p == ps->end || (!isdigit((unsigned char)*p) && *p != ','))
+        return 0;
+
+    /* stop accumulating past RE_DUP_MAX, but keep reading the digits */
+    for (; p < ps->end && isdigit((unsigned char)*p); p++) {
+        if (lo <= RE_DUP_MAX)
+            lo = lo * 10 + (*p - '0');
+    }
+
+    hi = lo;
+    if (p < ps->end && *p == ',') {
+        p++;
+        hi = -1;
+        if (p < ps->end && isdigit((unsigned char)*p)) {
+            hi = 0;
+            for (; p < ps->end && isdigit((unsigned char)*p); p++) {
+                if (hi <= RE_DUP_MAX)
+                    hi = hi * 10 + (*p - '0');
+            }
+        }
+    }
+
+    if (p == ps->end || *p != '}')
+        return 0;
+
+    if (lo > RE_DUP_MAX || hi > RE_DUP_MAX || (hi >= 0 && hi < lo)) {
+        ps->err = "invalid repetition count";
+        return -1;
+    }
+
+    ps->p = p + 1;
+    *min = (int)lo;
+    *max = (int)hi;
+
+    return 1;
+}
+
+static int
+parse_repeat(struct parser *ps)
+{
+    int a, min, max, ret;
+
+    a = parse_atom(ps);
+
+    while (a >= 0 && ps->p < ps->end) {
+        switch (*ps->p) {
+        case '*':
+            min = 0;
+            max = -1;
+            ps->p++;
+            break;
+        case '+':
+            min = 1;
+            max = -1;
+            ps->p++;
+            break;
+        case '?':
+            min = 0;
+            max = 1;
+            ps->p++;
+            break;
+        case '{':
+            ret = parse_bound(ps, &min, &max);
+            if (ret <= 0)
+                return ret < 0 ? -1 : a;
+            break;
+        default:
+            return a;
+        }
+
+        a = new_node(ps, N_REPEAT, a, -1);
+        ps->nodes[a].min = min;
+        ps->nodes[a].max = max;
+    }
+
+    return a;
+}
+
+static int
+parse_cat(struct parser *ps)
+{
+    int a = -1, b;
+
+    /* an unmatched ')' is an ordinary character */
+    while (ps->p < ps->end && *ps->p != '|' && !(*ps->p == ')' && ps->depth > 0)) {
+        b = parse_repeat(ps);
+        if (b < 0)
+            return -1;
+        a = a < 0 ? b : new_node(ps, N_CAT, a, b);
+    }
+
+    return a < 0 ? new_node(ps, N_EMPTY, -1, -1) : a;
+}
+
+static int
+parse_alt(struct parser *ps)
+{
+    int a, b;
+
+    a = parse_cat(ps);
+
+    while (a >= 0 && ps->p < ps->end && *ps->p == '|') {
+        ps->p++;
+        b = parse_cat(ps);
+        if (b < 0)
+            return -1;
+        a = new_node(ps, N_ALT, a, b);
+    }
+
+    return a;
+}
+
+/*
+ * Thompson construction.  Each node compiles to a fragment that falls
+ * through to the next instruction when it matches.
+ */
+
+static int
+emit(struct parser *ps, int op, uint32_t x, uint32_t y)
+{
+    struct re *re = ps->re;
+
+    if (re->nprog == RE_MAX_PROG) {
+        ps->err = "regular expression too big";
+        return -1;
+    }
+
+    re->prog = mu_reallocarray(re->prog, re->nprog + 1, sizeof(*re->prog));
+    re->prog[re->nprog].op = (uint8_t)op;
+    re->prog[re->nprog].x = x;
+    re->prog[re->nprog].y = y;
+
+    return (int)re->nprog++;
+}
+
+static int
+compile_node(struct parser *ps, int i)
+{
+    const struct node *n = &ps->nodes[i];
+    struct re *re = ps->re;
+    uint64_t bits[4] = {0, 0, 0, 0};
+    uint32_t *holes;
+    int k, pc, ret = 0;
+
+    switch (n->type) {
+    case N_EMPTY:
+        return 0;
+    case N_LIT:
+        bit_set(bits, n->c);
+        if (re->icase)
+            bits_fold(bits);
+        return emit(ps, RE_SET, re_add_set(re, bits), 0) < 0 ? -1 : 0;
+    case N_SET:
+        return emit(ps, RE_SET, n->set, 0) < 0 ? -1 : 0;
+    case N_BOL:
+        return emit(ps, RE_BOL, 0, 0) < 0 ? -1 : 0;
+    case N_EOL:
+        return emit(ps, RE_EOL, 0, 0) < 0 ? -1 : 0;
+    case N_CAT:
+        if (compile_node(ps, n->a) < 0)
+            return -1;
+        return compile_node(ps, n->b);
+    case N_ALT:
+        pc = emit(ps, RE_SPLIT, 0, 0);
+        if (pc < 0 || compile_node(ps, n->a) < 0)
+            return -1;
+        k = emit(ps, RE_JMP, 0, 0);
+        if (k < 0)
+            return -1;
+        re->prog[pc].x = (uint32_t)pc + 1;
+        re->prog[pc].y = (uint32_t)re->nprog;
+        if (compile_node(ps, n->b) < 0)
+            return -1;
+        re->prog[k].x = (uint32_t)re->nprog;
+        return 0;
+    case N_REPEAT:
+        break;
+    }
+
+    for (k = 0; k < n->min; k++) {
+        if (compile_node(ps, n->a) < 0)
+            return -1;
+    }
+
+    if (n->max < 0) {
+        /* x* */
+        pc = emit(ps, RE_SPLIT, 0, 0);
+        if (pc < 0 || compile_node(ps, n->a) < 0 || emit(ps, RE_JMP, (uint32_t)pc, 0) < 0)
+            return -1;
+        re->prog[pc].x = (uint32_t)pc + 1;
+        re->prog[pc].y = (uint32_t)re->nprog;
+        return 0;
+    }
+
+    /* (x(x(x)?)?)? for the optional copies; skipping one skips the rest */
+    holes = mu_mallocarray((size_t)(n->max - n->min) + 1, sizeof(*holes));
+    for (k = 0; k < n->max - n->min; k++) {
+        pc = emit(ps, RE_SPLIT, 0, 0);
+        if (pc < 0 || compile_node(ps, n->a) < 0) {
+            ret = -1;
+            break;
+        }
+        re->prog[pc].x = (uint32_t)pc + 1;
+        holes[k] = (uint32_t)pc;
+    }
+
+    if (ret == 0) {
+        while (k-- > 0)
+            re->prog[holes[k]].y = (uint32_t)re->nprog;
+    }
+
+    free(holes);
+    return ret;
+}
+
+/*
+ * Literal extraction for the prefilter.  For each node we work out the
+ * strings every match of it must start and end with, whether it only ever
+ * matches one string, and a set of literals one of which every match must
+ * contain.  Concatenation joins the end of one side to the start of the
+ * other, so "ab[0-9]cd" yields "ab" and "cd", and "x(ab|cd)y" yields the
+ * set {"ab", "cd"}.
+ */
+
+struct str {
+    char *s;
+    size_t len;
+};
+
+struct litset {
+    struct str *v;
+    size_t n;           /* 0 means no requirement */
+};
+
+struct lit_info {
+    bool exact;         /* matches only the string in prefix (and suffix) */
+    struct str prefix;
+    struct str suffix;
+    struct litset req;
+};
+
+static struct str
+str_new(const char *s, size_t len)
+{
+    struct str r;
+
+    r.s = mu_calloc(1, len + 1);
+    memcpy(r.s, s, len);
+    r.len = len;
+
+    return r;
+}
+
+static struct str
+str_cat(struct str a, struct str b)
+{
+    struct str r;
+
+    r.s = mu_calloc(1, a.len + b.len + 1);
+    memcpy(r.s, a.s, a.len);
+    memcpy(r.s + a.len, b.s, b.len);
+    r.len = a.len + b.len;
+
+    return r;
+}
+
+static void
+litset_free(struct litset *set)
+{
+    size_t i;
+
+    for (i = 0; i < set->n; i++)
+        free(set->v[i].s);
+
+    free(set->v);
+    set->v = NULL;
+    set->n = 0;
+}
+
+/* Make set the one literal s, taking ownership of it. */
+static void
+litset_one(struct litset *set, struct str s)
+{
+    set->v = mu_mallocarray(1, sizeof(*set->v));
+    set->v[0] = s;
+    set->n = 1;
+}
+
+/* The length of the shortest literal; the longer, the fewer false hits. */
+static size_t
+litset_score(const struct litset *set)
+{
+    size_t i, min = SIZE_MAX;
+
+    if (set->n == 0)
+        return 0;
+
+    for (i = 0; i < set->n; i++)
+        min = MU_MIN(min, set->v[i].len);
+
+    return min;
+}
+
+/* Keep the better of *best and *other in *best, and free the other one. */
+static void
+litset_pick(struct litset *best, struct litset *other)
+{
+    struct litset tmp;
+    size_t a = litset_score(best), b = litset_score(other);
+
+    if (b > a || (b == a && b > 0 && other->n < best->n)) {
+        tmp = *best;
+        *best = *other;
+        *other = tmp;
+    }
+
+    litset_free(other);
+}
+
+static void
+lit_info_free(struct lit_info *info)
+{
+    free(info->prefix.s);
+    free(info->suffix.s);
+    litset_free(&info->req);
+}
+
+static void
+lit_analyze(const struct parser *ps, int i, struct lit_info *info)
+{
+    const struct node *n = &ps->nodes[i];
+    struct lit_info a, b;
+    struct litset mid = {NULL, 0};
+    struct str s;
+
+    memset(info, 0, sizeof(*info));
+
+    switch (n->type) {
+    case N_EMPTY:
+        info->exact = true;
+        info->prefix = str_new("", 0);
+        info->suffix = str_new("", 0);
+        break;
+    case N_LIT:
+        if (n->c == '\n') {
+            info->prefix = str_new("", 0);
+            info->suffix = str_new("", 0);
+            break;
+        }
+        info->exact = true;
+        info->prefix = str_new((const char *)&n->c, 1);
+        info->suffix = str_new((const char *)&n->c, 1);
+        litset_one(&info->req, str_new((const char *)&n->c, 1));
+        break;
+    case N_SET:
+    case N_BOL:
+    case N_EOL:
+        info->prefix = str_new("", 0);
+        info->suffix = str_new("", 0);
+        break;
+    case N_CAT:
+        lit_analyze(ps, n->a, &a);
+        lit_analyze(ps, n->b, &b);
+
+        info->exact = a.exact && b.exact;
+        info->prefix = a.exact ? str_cat(a.prefix, b.prefix) : str_new(a.prefix.s, a.prefix.len);
+        info->suffix = b.exact ? str_cat(a.suffix, b.suffix) : str_new(b.suffix.s, b.suffix.len);
+
+        s = str_cat(a.suffix, b.prefix);
+        if (s.len > 0)
+            litset_one(&mid, s);
+        else
+            free(s.s);
+
+        info->req = a.req;
+        litset_pick(&info->req, &b.req);
+        litset_pick(&info->req, &mid);
+        a.req.n = 0;
+        a.req.v = NULL;
+
+        lit_info_free(&a);
+        lit_info_free(&b);
+        break;
+    case N_ALT:
+        lit_analyze(ps, n->a, &a);
+        lit_analyze(ps, n->b, &b);
+
+        info->prefix = str_new("", 0);
+        info->suffix = str_new("", 0);
+
+        /* a match of either side contains one of that side's literals */
+        if (a.req.n > 0 && b.req.n > 0 && a.req.n + b.req.n <= RE_MAX_LITS) {
+            info->req.v = mu_reallocarray(a.req.v, a.req.n + b.req.n, sizeof(*a.req.v));
+            memcpy(info->req.v + a.req.n, b.req.v, b.req.n * sizeof(*b.req.v));
+            info->req.n = a.req.n + b.req.n;
+            a.req.v = NULL;
+            a.req.n = 0;
+            free(b.req.v);
+            b.req.v = NULL;
+            b.req.n = 0;
+        }
+
+        lit_info_free(&a);
+        lit_info_free(&b);
+        break;
+    case N_REPEAT:
+        lit_analyze(ps, n->a, &a);
+
+        if (n->min == 0) {
+            lit_info_free(&a);
+            info->prefix = str_new("", 0);
+            info->suffix = str_new("", 0);
+            break;
+        }
+
+        /* at least one copy: the copy's requirements hold */
+        info->exact = n->min == 1 && n->max == 1 && a.exact;
+        info->prefix = a.prefix;
+        info->suffix = a.suffix;
+        info->req = a.req;
+        break;
+    }
+}
+
+/*
+ * If the tree rooted at i only matches a few plain strings, as in "foo" or
+ * "foo|bar", add them to set and return true.
+ */
+static bool
+lit_whole(const struct parser *ps, int i, struct litset *set)
+{
+    const struct node *n = &ps->nodes[i];
+    struct lit_info info;
+    bool ok;
+
+    if (n->type == N_ALT)
+        return lit_whole(ps, n->a, set) && lit_whole(ps, n->b, set);
+
+    lit_analyze(ps, i, &info);
+
+    ok = info.exact && info.prefix.len > 0 && set->n < RE_MAX_LITS;
+    if (ok) {
+        set->v = mu_reallocarray(set->v, set->n + 1, sizeof(*set->v));
+        set->v[set->n++] = info.prefix;
+        info.prefix.s = NULL;
+    }
+
+    lit_info_free(&info);
+    return ok;
+}
+
+/* Set up the prefilter from the literals in the tree rooted at root. */
+static void
+re_set_lits(struct re *re, const struct parser *ps, int root)
+{
+    struct lit_info info;
+    size_t i;
+
+    memset(&info, 0, sizeof(info));
+    re->lits_whole = lit_whole(ps, root, &info.req);
+    if (!re->lits_whole) {
+        litset_free(&info.req);
+        lit_analyze(ps, root, &info);
+    }
+
+    re->nlits = info.req.n;
+    if (re->nlits > 0) {
+        re->lits = mu_mallocarray(re->nlits, sizeof(*re->lits));
+        re->lit_lens = mu_mallocarray(re->nlits, sizeof(*re->lit_lens));
+        for (i = 0; i < re->nlits; i++) {
+            re->lits[i] = info.req.v[i].s;
+            re->lit_lens[i] = info.req.v[i].len;
+        }
+        free(info.req.v);
+        info.req.v = NULL;
+        info.req.n = 0;
+    }
+
+    if (re->nlits == 1)
+        search_compile(&re->lit, re->lits[0], re->lit_lens[0], re->icase);
+
+    if (re->nlits > 1) {
+        for (i = 0; i < re->nlits; i++)
+            ac_add(&re->ac, re->lits[i], re->lit_lens[i]);
+        ac_compile(&re->ac);
+    }
+
+    lit_info_free(&info);
+}
+
+/*
+ * Split the bytes into classes that no set tells apart.  The newline gets
+ * a class of its own, since it ends the line.
+ */
+static void
+re_compute_classes(struct re *re)
+{
+    size_t total[256], in[256];
+    int split[256];
+    size_t i;
+    unsigned int c, k;
+
+    memset(re->cls, 0, sizeof(re->cls));
+    re->cls['\n'] = 1;
+    re->nclasses = 2;
+
+    for (i = 0; i < re->nsets; i++) {
+        memset(total, 0, sizeof(total));
+        memset(in, 0, sizeof(in));
+        memset(split, 0xff, sizeof(split));
+
+        for (c = 0; c < 256; c++) {
+            total[re->cls[c]]++;
+            if (bit_test(re->sets[i], c))
+                in[re->cls[c]]++;
+        }
+
+        /* move the bytes in the set out of any class the set only partly covers */
+        for (c = 0; c < 256; c++) {
+            k = re->cls[c];
+            if (!bit_test(re->sets[i], c) || in[k] == total[k])
+                continue;
+            if (split[k] < 0)
+                split[k] = (int)re->nclasses++;
+            re->cls[c] = (uint8_t)split[k];
+        }
+    }
+
+    for (c = 256; c-- > 0; )
+        re->rep[re->cls[c]] = (uint8_t)c;
+}
+
+const char *
+re_compile(struct re *re, char **patterns, size_t npatterns, bool icase)
+{
+    struct parser ps;
+    int root = -1, a;
+    size_t i;
+
+    mu_memzero_p(re);
+    re->icase = icase;
+    ac_init(&re->ac, icase);
+
+    memset(&ps, 0, sizeof(ps));
+    ps.re = re;
+
+    for (i = 0; i < npatterns; i++) {
+        ps.p = patterns[i];
+        ps.end = patterns[i] + strlen(patterns[i]);
+        ps.depth = 0;
+
+        a = parse_alt(&ps);
+        if (a < 0)
+            goto fail;
+
+        root = root < 0 ? a : new_node(&ps, N_ALT, root, a);
+    }
+
+    if (compile_node(&ps, root) < 0 || emit(&ps, RE_MATCH, 0, 0) < 0)
+        goto fail;
+
+    re_compute_classes(re);
+    re_set_lits(re, &ps, root);
+
+    free(ps.nodes);
+    return NULL;
+
+fail:
+    free(ps.nodes);
+    re_deinit(re);
+    return ps.err;
+}
+
+void
+re_deinit(struct re *re)
+{
+    size_t i;
+
+    for (i = 0; i < re->nlits; i++)
+        free(re->lits[i]);
+
+    free(re->lits);
+    free(re->lit_lens);
+    free(re->prog);
+    free(re->sets);
+    if (re->nlits == 1)
+        search_free(&re->lit);
+    ac_deinit(&re->ac);
+    mu_memzero_p(re);
+}
+
+/*
+ * The lazy DFA.
+ */
+
+void
+re_dfa_init(struct re_dfa *dfa, const struct re *re)
+{
+    mu_memzero_p(dfa);
+    dfa->re = re;
+    dfa->start = RE_DFA_NONE;
+    dfa->table_size = 64;
+    dfa->table = mu_mallocarray(dfa->table_size, sizeof(*dfa->table));
+    memset(dfa->table, 0xff, dfa->table_size * sizeof(*dfa->table));
+
+    dfa->set = mu_mallocarray(re->nprog, sizeof(*dfa->set));
+    dfa->stack = mu_mallocarray(2 * re->nprog + 1, sizeof(*dfa->stack));
+    dfa->mark = mu_calloc(re->nprog, sizeof(*dfa->mark));
+}
+
+static void
+dfa_flush(struct re_dfa *dfa)
+{
+    size_t i;
+
+    for (i = 0; i < dfa->nstates; i++) {
+        free(dfa->states[i].pcs);
+        free(dfa->states[i].next);
+    }
+
+    dfa->nstates = 0;
+    dfa->mem = 0;
+    dfa->start = RE_DFA_NONE;
+    dfa->flushes++;
+    memset(dfa->table, 0xff, dfa->table_size * sizeof(*dfa->table));
+}
+
+void
+re_dfa_deinit(struct re_dfa *dfa)
+{
+    dfa_flush(dfa);
+    free(dfa->states);
+    free(dfa->table);
+    free(dfa->set);
+    free(dfa->stack);
+    free(dfa->mark);
+    mu_memzero_p(dfa);
+}
+
+/* Start building a new set of program positions in dfa->set. */
+static void
+dfa_begin(struct re_dfa *dfa)
+{
+    dfa->nset = 0;
+
+    if (++dfa->gen == 0) {
+        memset(dfa->mark, 0, dfa->re->nprog * sizeof(*dfa->mark));
+        dfa->gen = 1;
+    }
+}
+
+/*
+ * Add the positions reachable from pc without consuming a byte.  The
+ * assertions are only passed when they hold.
+ */
+static void
+dfa_closure(struct re_dfa *dfa, uint32_t pc, bool at_bol, bool at_eol)
+{
+    const struct re_inst *prog = dfa->re->prog;
+    size_t sp = 0;
+
+    dfa->stack[sp++] = pc;
+
+    while (sp > 0) {
+        pc = dfa->stack[--sp];
+        if (dfa->mark[pc] == dfa->gen)
+            continue;
+        dfa->mark[pc] = dfa->gen;
+
+        switch (prog[pc].op) {
+        case RE_JMP:
+            dfa->stack[sp++] = prog[pc].x;
+            break;
+        case RE_SPLIT:
+            dfa->stack[sp++] = prog[pc].y;
+            dfa->stack[sp++] = prog[pc].x;
+            break;
+        case RE_BOL:
+            if (at_bol)
+                dfa->stack[sp++] = pc + 1;
+            break;
+        case RE_EOL:
+            if (at_eol) {
+                dfa->stack[sp++] = pc + 1;
+                break;
+            }
+            /* fall through */
+        default:
+            dfa->set[dfa->nset++] = pc;
+            break;
+        }
+    }
+}
+
+static int
+cmp_u32(const void *a, const void *b)
+{
+    uint32_t x = *(const uint32_t *)a, y = *(const uint32_t *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+static uint32_t
+hash_pcs(const uint32_t *pcs, size_t n)
+{
+    uint32_t h = 2166136261U;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        h = (h ^ pcs[i]) * 16777619U;
+
+    return h;
+}
+
+static bool
+state_is_match(const struct re_dfa *dfa, const struct re_state *st)
+{
+    /* RE_MATCH is the last instruction, so it sorts last */
+    return st->npcs > 0 && st->pcs[st->npcs - 1] == dfa->re->nprog - 1;
+}
+
+static void
+dfa_table_insert(struct re_dfa *dfa, uint32_t idx)
+{
+    size_t mask = dfa->table_size - 1, i;
+
+    for (i = dfa->states[idx].hash & mask; dfa->table[i] != RE_DFA_NONE; i = (i + 1) & mask)
+        ;
+
+    dfa->table[i] = idx;
+}
+
+/* Return the state for the set in dfa->set, adding it if it's new, tagged with DFA_MATCH. */
+static uint32_t
+dfa_intern(struct re_dfa *dfa)
+{
+    struct re_state *st;
+    size_t mask = dfa->table_size - 1, i, nclasses = dfa->re->nclasses, mem;
+    uint32_t hash, idx;
+
+    qsort(dfa->set, dfa->nset, sizeof(*dfa->set), cmp_u32);
+    hash = hash_pcs(dfa->set, dfa->nset);
+
+    for (i = hash & mask; dfa->table[i] != RE_DFA_NONE; i = (i + 1) & mask) {
+        st = &dfa->states[dfa->table[i]];
+        if (st->hash == hash && st->npcs == dfa->nset &&
+                memcmp(st->pcs, dfa->set, dfa->nset * sizeof(*dfa->set)) == 0)
+            return dfa->table[i] | (state_is_match(dfa, st) ? DFA_MATCH : 0);
+    }
+
+    mem = sizeof(*st) + dfa->nset * sizeof(*dfa->set) + nclasses * sizeof(*st->next);
+    if (dfa->mem + mem > RE_CACHE_SIZE && dfa->nstates > 0)
+        dfa_flush(dfa);
+    dfa->mem += mem;
+
+    if (dfa->nstates == dfa->cap) {
+        dfa->cap = dfa->cap == 0 ? 64 : dfa->cap * 2;
+        dfa->states = mu_reallocarray(dfa->states, dfa->cap, sizeof(*dfa->states));
+    }
+
+    idx = (uint32_t)dfa->nstates++;
+    st = &dfa->states[idx];
+    st->pcs = mu_mallocarray(dfa->nset + 1, sizeof(*st->pcs));
+    memcpy(st->pcs, dfa->set, dfa->nset * sizeof(*dfa->set));
+    st->npcs = dfa->nset;
+    st->hash = hash;
+    st->next = mu_mallocarray(nclasses, sizeof(*st->next));
+    memset(st->next, 0xff, nclasses * sizeof(*st->next));
+
+    /* keep the table at most half full */
+    if (2 * dfa->nstates > dfa->table_size) {
+        dfa->table_size *= 2;
+        dfa->table = mu_reallocarray(dfa->table, dfa->table_size, sizeof(*dfa->table));
+        memset(dfa->table, 0xff, dfa->table_size * sizeof(*dfa->table));
+        for (i = 0; i < dfa->nstates; i++)
+            dfa_table_insert(dfa, (uint32_t)i);
+    } else {
+        dfa_table_insert(dfa, idx);
+    }
+
+    /* would the line end here complete a match? */
+    dfa_begin(dfa);
+    for (i = 0; i < st->npcs; i++) {
+        if (dfa->re->prog[st->pcs[i]].op != RE_SET)
+            dfa_closure(dfa, st->pcs[i], false, true);
+    }
+    st->match_eol = dfa->mark[dfa->re->nprog - 1] == dfa->gen;
+
+    return idx | (state_is_match(dfa, st) ? DFA_MATCH : 0);
+}
+
+static uint32_t
+dfa_start(struct re_dfa *dfa)
+{
+    if (dfa->start == RE_DFA_NONE) {
+        dfa_begin(dfa);
+        dfa_closure(dfa, 0, true, false);
+        dfa->start = dfa_intern(dfa);
+    }
+
+    return dfa->start;
+}
+
+/* Work out the transition from state s on byte class cls. */
+static uint32_t
+dfa_step(struct re_dfa *dfa, uint32_t s, unsigned int cls)
+{
+    const struct re *re = dfa->re;
+    const struct re_state *st = &dfa->states[s];
+    unsigned char c = re->rep[cls];
+    size_t i, flushes = dfa->flushes;
+    uint32_t pc, t;
+
+    dfa_begin(dfa);
+    for (i = 0; i < st->npcs; i++) {
+        pc = st->pcs[i];
+        if (re->prog[pc].op == RE_SET && bit_test(re->sets[re->prog[pc].x], c))
+            dfa_closure(dfa, pc + 1, false, false);
+    }
+
+    /* the search is unanchored: a match may start at any byte */
+    dfa_closure(dfa, 0, false, false);
+
+    t = dfa_intern(dfa);
+
+    /* if the cache was flushed, s is gone */
+    if (dfa->flushes == flushes)
+        dfa->states[s].next[cls] = t;
+
+    return t;
+}
+
+/* Run the DFA over [p, end), which starts at the beginning of a line. */
+static const char *
+dfa_search(struct re_dfa *dfa, const char *p, const char *end)
+{
+    const uint8_t *cls = dfa->re->cls;
+    const char *q;
+    uint32_t s, t;
+    unsigned char c;
+
+    if (p == end)
+        return NULL;
+
+    s = dfa_start(dfa);
+    if (s & DFA_MATCH)
+        return p;
+
+    for (q = p; q < end; q++) {
+        c = (unsigned char)*q;
+
+        if (c == '\n') {
+            if (dfa->states[s].match_eol)
+                return q;
+            if (q + 1 == end)
+                return NULL;
+            s = dfa_start(dfa);
+            if (s & DFA_MATCH)
+                return q + 1;
+            continue;
+        }
+
+        t = dfa->states[s].next[cls[c]];
+        if (t == DFA_UNKNOWN)
+            t = dfa_step(dfa, s, cls[c]);
+        if (t & DFA_MATCH)
+            return q;
+        s = t;
+    }
+
+    /* the last line has no newline */
+    return dfa->states[s].match_eol ? end - 1 : NULL;
+}
+
+static const char *
+lit_find(const struct re *re, const char *p, const char *end)
+{
+    if (re->nlits > 1)
+        return ac_find(&re->ac, p, (size_t)(end - p));
+
+    return search_exec(&re->lit, p, (size_t)(end - p));
+}
+
+const char *
+re_find(struct re_dfa *dfa, const char *p, const char *end)
+{
+    const char *hit, *bol, *eol, *m;
+
+    if (dfa->re->nlits == 0)
+        return dfa_search(dfa, p, end);
+
+    if (dfa->re->lits_whole)
+        return lit_find(dfa->re, p, end);
+
+    /* only the lines holding a required literal can match */
+    while (p < end) {
+        hit = lit_find(dfa->re, p, end);
+        if (hit == NULL)
+            return NULL;
+
+        bol = memrchr(p, '\n', (size_t)(hit - p));
+        bol = bol == NULL ? p : bol + 1;
+        eol = memchr(hit, '\n', (size_t)(end - hit));
+        eol = eol == NULL ? end : eol + 1;
+
+        m = dfa_search(dfa, bol, eol);
+        if (m != NULL)
+            return m;
+
+        p = eol;
+    }
+
+    return NULL;
+}
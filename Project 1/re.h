@@ -0,0 +1,99 @@
+#ifndef _RE_H_
+#define _RE_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "ac.h"
+#include "search.h"
+
+/*
+ * POSIX extended regular expressions, matched a line at a time.
+ *
+ * A pattern is parsed and compiled to a Thompson NFA program.  Matching
+ * runs a DFA built lazily from that program: a DFA state is the set of
+ * program positions the NFA could be in, and each transition is worked out
+ * the first time the input takes it.  The states live in a cache of bounded
+ * size that is flushed when it fills up, so a pattern whose full DFA would
+ * be huge costs time rather than memory.
+ *
+ * Before the DFA runs, a prefilter searches for the literal strings that
+ * every match must contain, and only the lines holding one of them are
+ * given to the DFA.
+ */
+
+struct re_inst {
+    uint8_t op;
+    uint32_t x;     /* RE_SET: index of the byte set; RE_JMP, RE_SPLIT: target */
+    uint32_t y;     /* RE_SPLIT: the other target */
+};
+
+struct re {
+    struct re_inst *prog;
+    size_t nprog;
+    uint64_t (*sets)[4];    /* bitmap of the bytes each RE_SET accepts */
+    size_t nsets;
+    bool icase;
+
+    uint8_t cls[256];       /* byte -> class; bytes in a class always take the same transition */
+    uint8_t rep[256];       /* class -> a byte in it */
+    size_t nclasses;
+
+    /* prefilter: every match contains one of these; with none, there is no prefilter */
+    char **lits;
+    size_t *lit_lens;
+    size_t nlits;
+    bool lits_whole;        /* the pattern matches just these strings, so the DFA isn't needed */
+    struct search lit;      /* for one literal */
+    struct ac ac;           /* for more than one literal */
+};
+
+struct re_state;
+
+/*
+ * The lazily built DFA for a struct re.  Building it changes it, so every
+ * thread searching with the same re needs its own.
+ */
+struct re_dfa {
+    const struct re *re;
+    struct re_state *states;
+    size_t nstates;
+    size_t cap;
+    uint32_t *table;        /* open-addressed hash table of state indices */
+    size_t table_size;
+    size_t mem;             /* bytes held by the states */
+    size_t flushes;
+    uint32_t start;         /* state at the start of a line, or RE_DFA_NONE */
+
+    /* scratch space for building a state */
+    uint32_t *set;
+    size_t nset;
+    uint32_t *stack;
+    uint32_t *mark;
+    uint32_t gen;
+};
+
+#define RE_DFA_NONE UINT32_MAX
+
+/*
+ * Compile the patterns into re; a line matches if any of them matches.
+ * With icase, ASCII letters match either case.
+ *
+ * On success, return NULL.
+ * On failure, return a message saying what is wrong with the pattern.
+ */
+const char *re_compile(struct re *re, char **patterns, size_t npatterns, bool icase);
+void re_deinit(struct re *re);
+
+void re_dfa_init(struct re_dfa *dfa, const struct re *re);
+void re_dfa_deinit(struct re_dfa *dfa);
+
+/*
+ * Search [p, end), which must start at the beginning of a line, for a line
+ * that matches.  Return a pointer into the first such line, or NULL if
+ * there is none.
+ */
+const char *re_find(struct re_dfa *dfa, const char *p, const char *end);
+
+#endif /* _RE_H_ */
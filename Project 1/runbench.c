@@ -0,0 +1,231 @@
+/*
+ * runbench: time sgrep in each of its main modes over a corpus and report
+ * the throughput as JSON, so results from different builds can be diffed
+ * or compared by a script.
+ */
+
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "mu.h"
+
+#define USAGE \
+    "Usage: runbench [-r RUNS] [-e ENGINE] SGREP CORPUS STR\n" \
+    "\n" \
+    "Run SGREP over CORPUS looking for STR in each mode (no options, -c, -n, -B 3, -i\n" \
+    "and -v), RUNS times each (default 5) after one untimed run to warm the page cache.\n" \
+    "Print a JSON report of the best and median times, in GB/s and lines/s, to stdout.\n" \
+    "With -e, pass --engine=ENGINE to SGREP.\n"
+
+#define BENCH_MAX_ARGS 8
+
+struct mode {
+    const char *name;
+    const char *args[3];
+};
+
+static const struct mode modes[] = {
+    {"default", {NULL}},
+    {"-c", {"-c", NULL}},
+    {"-n", {"-n", NULL}},
+    {"-B 3", {"-B", "3", NULL}},
+    {"-i", {"-i", NULL}},
+    {"-v", {"-v", NULL}},
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/* Count the lines in path; a last line without a newline counts too. */
+static size_t
+corpus_lines(const char *path, size_t *size)
+{
+    struct stat st;
+    const char *buf, *p, *end;
+    size_t n = 0;
+    int fd;
+
+    fd = open(path, O_RDONLY);
+    if (fd == -1 || fstat(fd, &st) == -1)
+        mu_die_errno(errno, "runbench: %s", path);
+
+    *size = (size_t)st.st_size;
+    if (*size == 0) {
+        close(fd);
+        return 0;
+    }
+
+    buf = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (buf == MAP_FAILED)
+        mu_die_errno(errno, "runbench: mmap %s", path);
+
+    end = buf + *size;
+    for (p = buf; (p = memchr(p, '\n', (size_t)(end - p))) != NULL; p++)
+        n++;
+    if (end[-1] != '\n')
+        n++;
+
+    munmap((void *)buf, *size);
+    close(fd);
+    return n;
+}
+
+/* Run argv with its output thrown away, and return the wall-clock time it took. */
+static double
+run(char **argv)
+{
+    double start;
+    pid_t pid;
+    int status, fd;
+
+    start = now();
+
+    pid = fork();
+    if (pid == -1)
+        mu_die_errno(errno, "runbench: fork");
+
+    if (pid == 0) {
+        fd = open("/dev/null", O_WRONLY);
+        if (fd == -1 || dup2(fd, STDOUT_FILENO) == -1)
+            _exit(127);
+        execv(argv[0], argv);
+        _exit(127);
+    }
+
+    if (waitpid(pid, &status, 0) == -1)
+        mu_die_errno(errno, "runbench: waitpid");
+
+    /* 0 and 1 are "found" and "not found"; anything else is a failure */
+    if (!WIFEXITED(status) || WEXITSTATUS(status) > 1)
+        mu_die("runbench: %s failed (status 0x%x)", argv[0], status);
+
+    return now() - start;
+}
+
+static int
+cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return (x > y) - (x < y);
+}
+
+static void
+json_str(const char *s)
+{
+    putchar('"');
+    for (; *s != '\0'; s++) {
+        if (*s == '"' || *s == '\\')
+            printf("\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            printf("\\u%04x", (unsigned char)*s);
+        else
+            putchar(*s);
+    }
+    putchar('"');
+}
+
+int
+main(int argc, char *argv[])
+{
+    char *args[BENCH_MAX_ARGS], *engine = NULL, *sgrep, *corpus, *str;
+    double *times, best, median;
+    size_t size, lines, i, k, nargs;
+    int opt, runs = 5, r, ret;
+
+    while ((opt = getopt(argc, argv, ":r:e:h")) != -1) {
+        switch (opt) {
+        case 'r':
+            ret = mu_str_to_int(optarg, 10, &runs);
+            if (ret != 0 || runs < 1)
+                mu_die("runbench: invalid number of runs \"%s\"", optarg);
+            break;
+        case 'e':
+            if (asprintf(&engine, "--engine=%s", optarg) == -1)
+                mu_die("runbench: out of memory");
+            break;
+        case 'h':
+            fputs(USAGE, stdout);
+            return 0;
+        default:
+            fputs(USAGE, stderr);
+            return 1;
+        }
+    }
+
+    if (argc - optind != 3) {
+        fputs(USAGE, stderr);
+        return 1;
+    }
+
+    sgrep = argv[optind];
+    corpus = argv[optind + 1];
+    str = argv[optind + 2];
+
+    lines = corpus_lines(corpus, &size);
+    times = mu_mallocarray((size_t)runs, sizeof(*times));
+
+    printf("{\n  \"sgrep\": ");
+    json_str(sgrep);
+    printf(",\n  \"corpus\": ");
+    json_str(corpus);
+    printf(",\n  \"bytes\": %zu,\n  \"lines\": %zu,\n  \"pattern\": ", size, lines);
+    json_str(str);
+    printf(",\n  \"engine\": ");
+    json_str(engine != NULL ? engine + strlen("--engine=") : "auto");
+    printf(",\n  \"runs\": %d,\n  \"results\": [\n", runs);
+
+    for (i = 0; i < sizeof(modes) / sizeof(modes[0]); i++) {
+        nargs = 0;
+        args[nargs++] = sgrep;
+        if (engine != NULL)
+            args[nargs++] = engine;
+        for (k = 0; modes[i].args[k] != NULL; k++)
+            args[nargs++] = (char *)modes[i].args[k];
+        args[nargs++] = str;
+        args[nargs++] = corpus;
+        args[nargs] = NULL;
+
+        (void)run(args);
+        for (r = 0; r < runs; r++)
+            times[r] = run(args);
+
+        qsort(times, (size_t)runs, sizeof(*times), cmp_double);
+        best = times[0];
+        median = times[runs / 2];
+
+        printf("    {\"mode\": ");
+        json_str(modes[i].name);
+        printf(", \"best_s\": %.6f, \"median_s\": %.6f, \"gb_per_s\": %.3f, \"lines_per_s\": %.0f}%s\n",
+                best, median, (double)size / best / 1e9, (double)lines / best,
+                i + 1 < sizeof(modes) / sizeof(modes[0]) ? "," : "");
+        fflush(stdout);
+    }
+
+    printf("  ]\n}\n");
+
+    free(times);
+    free(engine);
+    return 0;
+}
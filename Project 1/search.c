@@ -0,0 +1,573 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#   define SEARCH_X86 1
+#   include <cpuid.h>
+#   include <immintrin.h>
+#endif
+
+#include "mu.h"
+#include "search.h"
+
+/*
+ * The vector kernels use the first/last byte filter: compare a block of
+ * the haystack against the needle's first byte, and the same block shifted
+ * by (needle_len - 1) against its last byte.  Only positions where both
+ * agree are verified with a full compare, which on real text is rare.
+ */
+
+static inline unsigned char
+fold(unsigned char c)
+{
+    return (unsigned char)(c - 'A') < 26 ? c | 0x20 : c;
+}
+
+/* Return true if the n bytes at a and b are equal, ignoring ASCII case. */
+static bool
+casecmp_eq(const char *a, const char *b, size_t n)
+{
+    size_t i;
+
+    for (i = 0; i < n; i++) {
+        if (fold((unsigned char)a[i]) != fold((unsigned char)b[i]))
+            return false;
+    }
+
+    return true;
+}
+
+static const char *
+scalar_find(const char *hay, size_t hay_len, const char *needle, size_t needle_len)
+{
+    return memmem(hay, hay_len, needle, needle_len);
+}
+
+static const char *
+scalar_casefind(const char *hay, size_t hay_len, const char *needle, size_t needle_len)
+{
+    const char *p, *end;
+    unsigned char first;
+
+    if (needle_len == 0)
+        return hay;
+
+    if (hay_len < needle_len)
+        return NULL;
+
+    first = fold((unsigned char)needle[0]);
+    end = hay + (hay_len - needle_len);
+
+    for (p = hay; p <= end; p++) {
+        if (fold((unsigned char)*p) != first)
+            continue;
+        if (casecmp_eq(p + 1, needle + 1, needle_len - 1))
+            return p;
+    }
+
+    return NULL;
+}
+
+#ifdef SEARCH_X86
+
+__attribute__((target("sse2")))
+static inline __m128i
+sse2_fold(__m128i x)
+{
+    __m128i r = _mm_sub_epi8(x, _mm_set1_epi8('A'));
+    __m128i upper = _mm_cmpeq_epi8(_mm_min_epu8(r, _mm_set1_epi8(25)), r);
+
+    return _mm_or_si128(x, _mm_and_si128(upper, _mm_set1_epi8(0x20)));
+}
+
+__attribute__((target("sse2")))
+static const char *
+sse2_find(const char *hay, size_t hay_len, const char *needle, size_t needle_len)
+{
+    __m128i first, last, bf, bl;
+    unsigned int mask, bit;
+    size_t i;
+
+    if (needle_len == 0)
+        return hay;
+
+    if (hay_len < needle_len)
+        return NULL;
+
+    first = _mm_set1_epi8(needle[0]);
+    last = _mm_set1_epi8(needle[needle_len - 1]);
+
+    for (i = 0; i + needle_len + 15 <= hay_len; i += 16) {
+        bf = _mm_loadu_si128((const __m128i *)(hay + i));
+        bl = _mm_loadu_si128((const __m128i *)(hay + i + needle_len - 1));
+        mask = (unsigned int)_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl)));
+
+        while (mask != 0) {
+            bit = (unsigned int)__builtin_ctz(mask);
+            if (needle_len < 3 || memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0)
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return scalar_find(hay + i, hay_len - i, needle, needle_len);
+}
+
+__attribute__((target("sse2")))
+static const char *
+sse2_casefind(const char *hay, size_t hay_len, const char *needle, size_t needle_len)
+{
+    __m128i first, last, bf, bl;
+    unsigned int mask, bit;
+    size_t i;
+
+    if (needle_len == 0)
+        return hay;
+
+    if (hay_len < needle_len)
+        return NULL;
+
+    first = _mm_set1_epi8((char)fold((unsigned char)needle[0]));
+    last = _mm_set1_epi8((char)fold((unsigned char)needle[needle_len - 1]));
+
+    for (i = 0; i + needle_len + 15 <= hay_len; i += 16) {
+        bf = sse2_fold(_mm_loadu_si128((const __m128i *)(hay + i)));
+        bl = sse2_fold(_mm_loadu_si128((const __m128i *)(hay + i + needle_len - 1)));
+        mask = (unsigned int)_mm_movemask_epi8(
+                _mm_and_si128(_mm_cmpeq_epi8(first, bf), _mm_cmpeq_epi8(last, bl)));
+
+        while (mask != 0) {
+            bit = (unsigned int)__builtin_ctz(mask);
+            if (needle_len < 3 || casecmp_eq(hay + i + bit + 1, needle + 1, needle_len - 2))
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return scalar_casefind(hay + i, hay_len - i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+avx2_fold(__m256i x)
+{
+    __m256i r = _mm256_sub_epi8(x, _mm256_set1_epi8('A'));
+    __m256i upper = _mm256_cmpeq_epi8(_mm256_min_epu8(r, _mm256_set1_epi8(25)), r);
+
+    return _mm256_or_si256(x, _mm256_and_si256(upper, _mm256_set1_epi8(0x20)));
+}
+
+__attribute__((target("avx2")))
+static const char *
+avx2_find(const char *hay, size_t hay_len, const char *needle, size_t needle_len)
+{
+    __m256i first, last, bf, bl;
+    unsigned int mask, bit;
+    size_t i;
+
+    if (needle_len == 0)
+        return hay;
+
+    if (hay_len < needle_len)
+        return NULL;
+
+    first = _mm256_set1_epi8(needle[0]);
+    last = _mm256_set1_epi8(needle[needle_len - 1]);
+
+    for (i = 0; i + needle_len + 31 <= hay_len; i += 32) {
+        bf = _mm256_loadu_si256((const __m256i *)(hay + i));
+        bl = _mm256_loadu_si256((const __m256i *)(hay + i + needle_len - 1));
+        mask = (unsigned int)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl)));
+
+        while (mask != 0) {
+            bit = (unsigned int)__builtin_ctz(mask);
+            if (needle_len < 3 || memcmp(hay + i + bit + 1, needle + 1, needle_len - 2) == 0)
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return sse2_find(hay + i, hay_len - i, needle, needle_len);
+}
+
+__attribute__((target("avx2")))
+static const char *
+avx2_casefind(const char *hay, size_t hay_len, const char *needle, size_t needle_len)
+{
+    __m256i first, last, bf, bl;
+    unsigned int mask, bit;
+    size_t i;
+
+    if (needle_len == 0)
+        return hay;
+
+    if (hay_len < needle_len)
+        return NULL;
+
+    first = _mm256_set1_epi8((char)fold((unsigned char)needle[0]));
+    last = _mm256_set1_epi8((char)fold((unsigned char)needle[needle_len - 1]));
+
+    for (i = 0; i + needle_len + 31 <= hay_len; i += 32) {
+        bf = avx2_fold(_mm256_loadu_si256((const __m256i *)(hay + i)));
+        bl = avx2_fold(_mm256_loadu_si256((const __m256i *)(hay + i + needle_len - 1)));
+        mask = (unsigned int)_mm256_movemask_epi8(
+                _mm256_and_si256(_mm256_cmpeq_epi8(first, bf), _mm256_cmpeq_epi8(last, bl)));
+
+        while (mask != 0) {
+            bit = (unsigned int)__builtin_ctz(mask);
+            if (needle_len < 3 || casecmp_eq(hay + i + bit + 1, needle + 1, needle_len - 2))
+                return hay + i + bit;
+            mask &= mask - 1;
+        }
+    }
+
+    return sse2_casefind(hay + i, hay_len - i, needle, needle_len);
+}
+
+static uint64_t
+xgetbv(unsigned int index)
+{
+    unsigned int eax, edx;
+
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(index));
+    return ((uint64_t)edx << 32) | eax;
+}
+
+static bool
+cpu_has_sse2(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+
+    return (edx & bit_SSE2) != 0;
+}
+
+static bool
+cpu_has_avx2(void)
+{
+    unsigned int eax, ebx, ecx, edx;
+
+    if (!__get_cpuid(1, &eax, &ebx, &ecx, &edx))
+        return false;
+
+    if (!(ecx & bit_OSXSAVE) || !(ecx & bit_AVX))
+        return false;
+
+    /* the OS must save the XMM and YMM registers on a context switch */
+    if ((xgetbv(0) & 0x6) != 0x6)
+        return false;
+
+    if (!__get_cpuid_count(7, 0, &eax, &ebx, &ecx, &edx))
+        return false;
+
+    return (ebx & bit_AVX2) != 0;
+}
+
+#endif /* SEARCH_X86 */
+
+search_fn search_find = scalar_find;
+search_fn search_casefind = scalar_casefind;
+
+void
+search_init(void)
+{
+#ifdef SEARCH_X86
+    if (cpu_has_avx2()) {
+        search_find = avx2_find;
+        search_casefind = avx2_casefind;
+    } else if (cpu_has_sse2()) {
+        search_find = sse2_find;
+        search_casefind = sse2_casefind;
+    }
+#endif
+}
+
+/*
+ * Compiled needles and the engines that search for them.
+ */
+
+#define SEARCH_LONG_NEEDLE      32  /* needles this long with ... */
+#define SEARCH_MIN_ALPHABET     8   /* ... fewer distinct bytes than this go to Two-Way */
+
+static enum search_engine search_forced = SEARCH_AUTO;
+
+static const char *search_engine_names[] = {
+    [SEARCH_AUTO] = "auto",
+    [SEARCH_MEMCHR] = "memchr",
+    [SEARCH_SIMD] = "simd",
+    [SEARCH_HORSPOOL] = "horspool",
+    [SEARCH_TWOWAY] = "twoway",
+};
+
+int
+search_force_engine(const char *name)
+{
+    size_t i;
+
+    for (i = 0; i < sizeof(search_engine_names) / sizeof(search_engine_names[0]); i++) {
+        if (strcmp(name, search_engine_names[i]) == 0) {
+            search_forced = (enum search_engine)i;
+            return 0;
+        }
+    }
+
+    return -EINVAL;
+}
+
+static bool
+search_eq(const struct search *s, const unsigned char *p, size_t n)
+{
+    if (s->icase)
+        return casecmp_eq((const char *)p, (const char *)s->needle, n);
+
+    return memcmp(p, s->needle, n) == 0;
+}
+
+static const char *
+memchr_exec(const struct search *s, const char *hay, size_t hay_len)
+{
+    const char *p = hay, *end = hay + hay_len;
+
+    while ((p = memchr(p, s->needle[0], (size_t)(end - p))) != NULL) {
+        if ((size_t)(end - p) < s->len)
+            return NULL;
+        if (search_eq(s, (const unsigned char *)p, s->len))
+            return p;
+        p++;
+    }
+
+    return NULL;
+}
+
+static void
+horspool_compile(struct search *s)
+{
+    size_t i;
+
+    for (i = 0; i < 256; i++)
+        s->shift[i] = s->len;
+
+    for (i = 0; i + 1 < s->len; i++)
+        s->shift[s->needle[i]] = s->len - 1 - i;
+}
+
+static const char *
+horspool_exec(const struct search *s, const char *hay, size_t hay_len)
+{
+    const unsigned char *h = (const unsigned char *)hay;
+    size_t last = s->len - 1, pos = 0;
+    unsigned char c;
+
+    while (pos + s->len <= hay_len) {
+        c = s->map[h[pos + last]];
+        if (c == s->needle[last] && search_eq(s, h + pos, last))
+            return hay + pos;
+        pos += s->shift[c];
+    }
+
+    return NULL;
+}
+
+/*
+ * Two-Way (Crochemore and Perrin), as in musl's memmem: split the needle
+ * at its critical factorization, match the right part left to right and
+ * then the left part right to left, and on a full match of the right part
+ * remember how much of a periodic needle is already known to match.  The
+ * shift table lets a mismatch on the last byte skip ahead as Horspool does.
+ */
+static void
+twoway_compile(struct search *s)
+{
+    const unsigned char *n = s->needle;
+    size_t l = s->len, i, ip, jp, k, p, ms, p0;
+
+    for (i = 0; i < 256; i++)
+        s->shift[i] = 0;
+    for (i = 0; i < l; i++)
+        s->shift[n[i]] = i + 1;
+
+    /* the maximal suffix... */
+    ip = (size_t)-1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (n[ip + k] > n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    ms = ip;
+    p0 = p;
+
+    /* ...and under the opposite order; the critical factorization is the longer */
+    ip = (size_t)-1;
+    jp = 0;
+    k = p = 1;
+    while (jp + k < l) {
+        if (n[ip + k] == n[jp + k]) {
+            if (k == p) {
+                jp += p;
+                k = 1;
+            } else {
+                k++;
+            }
+        } else if (n[ip + k] < n[jp + k]) {
+            jp += k;
+            k = 1;
+            p = jp - ip;
+        } else {
+            ip = jp++;
+            k = p = 1;
+        }
+    }
+    if (ip + 1 > ms + 1)
+        ms = ip;
+    else
+        p = p0;
+
+    if (memcmp(n, n + p, ms + 1) != 0) {
+        /* not periodic: nothing can be remembered across shifts */
+        s->mem0 = 0;
+        p = (ms > l - ms - 1 ? ms : l - ms - 1) + 1;
+    } else {
+        s->mem0 = l - p;
+    }
+
+    s->ms = ms;
+    s->period = p;
+}
+
+static const char *
+twoway_exec(const struct search *s, const char *hay, size_t hay_len)
+{
+    const unsigned char *h = (const unsigned char *)hay, *z = h + hay_len;
+    const unsigned char *n = s->needle, *map = s->map;
+    size_t l = s->len, ms = s->ms, mem = 0, k;
+
+    for (;;) {
+        if ((size_t)(z - h) < l)
+            return NULL;
+
+        k = l - s->shift[map[h[l - 1]]];
+        if (k != 0) {
+            h += k < mem ? mem : k;
+            mem = 0;
+            continue;
+        }
+
+        /* the right part */
+        for (k = ms + 1 > mem ? ms + 1 : mem; k < l && n[k] == map[h[k]]; k++)
+            ;
+        if (k < l) {
+            h += k - ms;
+            mem = 0;
+            continue;
+        }
+
+        /* the left part */
+        for (k = ms + 1; k > mem && n[k - 1] == map[h[k - 1]]; k--)
+            ;
+        if (k <= mem)
+            return (const char *)h;
+
+        h += s->period;
+        mem = s->mem0;
+    }
+}
+
+/* Return the number of distinct bytes in the needle. */
+static size_t
+search_alphabet(const struct search *s)
+{
+    bool seen[256] = {false};
+    size_t i, n = 0;
+
+    for (i = 0; i < s->len; i++) {
+        if (!seen[s->needle[i]]) {
+            seen[s->needle[i]] = true;
+            n++;
+        }
+    }
+
+    return n;
+}
+
+void
+search_compile(struct search *s, const char *needle, size_t len, bool icase)
+{
+    size_t i;
+
+    memset(s, 0, sizeof(*s));
+    s->len = len;
+    s->icase = icase;
+    s->needle = mu_mallocarray(len + 1, 1);
+
+    for (i = 0; i < 256; i++)
+        s->map[i] = icase ? fold((unsigned char)i) : (unsigned char)i;
+    for (i = 0; i < len; i++)
+        s->needle[i] = s->map[(unsigned char)needle[i]];
+
+    s->engine = search_forced;
+    if (s->engine == SEARCH_AUTO) {
+        if (len == 1)
+            s->engine = SEARCH_MEMCHR;
+        else if (len >= SEARCH_LONG_NEEDLE && search_alphabet(s) < SEARCH_MIN_ALPHABET)
+            s->engine = SEARCH_TWOWAY;
+        else
+            s->engine = SEARCH_SIMD;
+    }
+
+    /* memchr can't look for both cases of a letter at once */
+    if (len == 0 || (s->engine == SEARCH_MEMCHR && icase &&
+                (unsigned char)(s->needle[0] - 'a') < 26))
+        s->engine = SEARCH_SIMD;
+
+    if (s->engine == SEARCH_HORSPOOL)
+        horspool_compile(s);
+    else if (s->engine == SEARCH_TWOWAY)
+        twoway_compile(s);
+}
+
+void
+search_free(struct search *s)
+{
+    free(s->needle);
+    memset(s, 0, sizeof(*s));
+}
+
+const char *
+search_exec(const struct search *s, const char *hay, size_t hay_len)
+{
+    switch (s->engine) {
+    case SEARCH_MEMCHR:
+        return memchr_exec(s, hay, hay_len);
+    case SEARCH_HORSPOOL:
+        return horspool_exec(s, hay, hay_len);
+    case SEARCH_TWOWAY:
+        return twoway_exec(s, hay, hay_len);
+    default:
+        if (s->icase)
+            return search_casefind(hay, hay_len, (const char *)s->needle, s->len);
+        return search_find(hay, hay_len, (const char *)s->needle, s->len);
+    }
+}
@@ -0,0 +1,80 @@
+#ifndef _SEARCH_H_
+#define _SEARCH_H_
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/*
+ * Substring search kernels.  All of them work on explicit lengths, so
+ * neither the haystack nor the needle needs to be nul-terminated, and
+ * both may contain nul bytes.
+ *
+ * Each returns a pointer to the first occurrence of needle in hay, or
+ * NULL if there is none.  An empty needle matches at hay.
+ */
+typedef const char *(*search_fn)(const char *hay, size_t hay_len,
+        const char *needle, size_t needle_len);
+
+/*
+ * The kernels chosen by search_init() for this CPU: AVX2 if the CPU and
+ * OS support it, else SSE2, else scalar.
+ */
+extern search_fn search_find;
+extern search_fn search_casefind;   /* ASCII case-insensitive */
+
+void search_init(void);
+
+/*
+ * A needle compiled for repeated searches.  There are four engines:
+ *
+ *  - SEARCH_MEMCHR: memchr (itself vectorized) for the first byte, then a
+ *    compare;
+ *  - SEARCH_SIMD: the kernels above;
+ *  - SEARCH_HORSPOOL: bad-character skip tables;
+ *  - SEARCH_TWOWAY: Two-Way, with Horspool's shift on the last byte.
+ *
+ * search_compile() picks memchr for a single byte and SIMD for most
+ * everything else: on text, the first/last filter reads 32 bytes a step
+ * and beats the skip tables even on 40-byte needles.  The filter's weak
+ * spot is a needle made of few distinct bytes, say "aaaa...b...aaaa",
+ * where every position passes it and the compares make the search
+ * quadratic; long needles like that go to Two-Way, which is linear.
+ * Horspool is only used when asked for.
+ */
+enum search_engine {
+    SEARCH_AUTO,
+    SEARCH_MEMCHR,
+    SEARCH_SIMD,
+    SEARCH_HORSPOOL,
+    SEARCH_TWOWAY,
+};
+
+struct search {
+    enum search_engine engine;
+    unsigned char *needle;      /* case-folded with icase */
+    size_t len;
+    bool icase;
+    unsigned char map[256];     /* byte -> byte as compared: identity, or folded */
+    size_t shift[256];          /* Horspool: skip; Two-Way: 1 + last index, or 0 */
+    size_t ms;                  /* Two-Way: critical factorization */
+    size_t period;
+    size_t mem0;
+};
+
+void search_compile(struct search *s, const char *needle, size_t len, bool icase);
+void search_free(struct search *s);
+
+/* Return the first occurrence of the compiled needle in hay, or NULL. */
+const char *search_exec(const struct search *s, const char *hay, size_t hay_len);
+
+/*
+ * Make search_compile() use the named engine ("memchr", "simd",
+ * "horspool", "twoway" or "auto") for benchmarking.  An engine that can't
+ * handle a needle (memchr with a letter and icase) falls back to SIMD.
+ *
+ * On success, return 0.
+ * On failure (an unknown name), return -EINVAL.
+ */
+int search_force_engine(const char *name);
+
+#endif /* _SEARCH_H_ */
@@ -1,8 +1,17 @@
 #define _GNU_SOURCE
 
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#include <dirent.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
 #include <limits.h>
 #include <getopt.h>
+#include <poll.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -10,16 +19,38 @@
 #include <unistd.h>
 #include <ctype.h>
 
-#include "list.h"
+#include "ac.h"
+#include "decomp.h"
+#include "index.h"
+#include "mu.h"
+#include "out.h"
+#include "re.h"
+#include "search.h"
+#include "xpthread.h"
 
 #define USAGE \
-    "Usage: sgrep [-c] [-h] [-n] [-q] [-B NUM] STR FILE \n" \
+    "Usage: sgrep [-c] [-E] [-F] [-h] [-n] [-q] [-r] [--index] [-A NUM] [-B NUM] [-C NUM] [-j NUM] STR FILE... \n" \
+    "       sgrep [OPTIONS] -e STR [-e STR ...] [-f PATFILE] FILE... \n" \
+    "       sgrep -r [OPTIONS] STR DIR... \n" \
+    "\n" \
+    "Print lines in FILE that match PATTERN.  If FILE is -, read stdin.  FILE may be\n" \
+    "compressed with gzip (or with zstd, if sgrep was built with it).\n" \
     "\n" \
-    "Print lines in FILE that match PATTERN.\n" \
+    "With more than one FILE, each line of output is prefixed with the file's path, and\n" \
+    "the files are searched in order, each one read ahead while the one before it is searched.\n" \
     "\n" \
     "Optional Arguments:\n" \
     "   -c, --count\n" \
     "       Suppress normal output; instead print a count of matching lines for the input file.\n" \
+    "       With more than one pattern, print STR:COUNT for each pattern instead (but not with -E).\n" \
+    "       With more than one FILE, print FILE:COUNT for each one, then total:COUNT for all of them.\n" \
+    "   -E, --extended-regexp\n" \
+    "       Treat STR as a POSIX extended regular expression.\n" \
+    "   -F, --follow\n" \
+    "       After searching FILE, keep waiting for lines to be appended to it and search them\n" \
+    "       too, until killed (or, with -q, until one matches).  If FILE is truncated, or\n" \
+    "       replaced by a new file of the same name (as when logs are rotated), start over\n" \
+    "       from the top of it, numbering lines from 1 again.  FILE is not decompressed.\n" \
     "   -h, --help\n" \
     "       Show usage statement and exit.\n" \
     "\n" \
@@ -27,386 +58,1795 @@
     "       Prefix each line of output with the 1-based line number of the file, followed immediately by a colon.\n" \
     "   -q, --quiet\n" \
     "       Do not write anything to stdout. Exit immediate with zero status if any match was found.\n" \
-    "       If a match is not found, exit with a non-zero status.\n" \
+    "       If a match is not found, exit with a non-zero status.  With -c, the count is still printed.\n" \
     "\n" \
+    "   -A NUM, --after-context NUM\n" \
+    "       Print NUM lines of trailing context after matching lines.\n" \
     "   -B NUM, --before-context NUM\n" \
-    "       Print NUM lines of leading context before matching lines.\n"
+    "       Print NUM lines of leading context before matching lines.\n" \
+    "   -C NUM, --context NUM\n" \
+    "       Print NUM lines of leading and trailing context.  Overlapping context is printed once;\n" \
+    "       a line containing \"--\" separates groups that are not adjacent (even with NUM 0).  With -n, context\n" \
+    "       lines are numbered as NUM- rather than NUM:.\n" \
+    "\n" \
+    "   -e STR, --pattern STR\n" \
+    "       Search for STR.  May be given more than once; a line matches if it contains any of them.\n" \
+    "   -f PATFILE, --file PATFILE\n" \
+    "       Search for each line of PATFILE, as with -e.\n" \
+    "\n" \
+    "   -j NUM, --threads NUM\n" \
+    "       Search FILE with NUM threads.  The output is the same as with one thread.\n" \
+    "       With -r, search NUM files at a time; the default is one per CPU.\n" \
+    "\n" \
+    "   -r, --recursive\n" \
+    "       Search every regular file under DIR.  Each line of output is prefixed with the\n" \
+    "       file's path; files are reported in no particular order.  Symbolic links and\n" \
+    "       special files are skipped, as are binary files (those with a nul byte near the start).\n" \
+    "\n" \
+    "   --index\n" \
+    "       Keep an index of FILE in FILE.sgrepidx, built on the first search and rebuilt when\n" \
+    "       FILE's size or mtime changes.  Later searches use it to find line numbers for -n\n" \
+    "       without counting every line, and to skip the parts of FILE that can't contain STR.\n" \
+    "       Not with -r.\n"
+
+#define die(fmt, ...) \
+    do { \
+        fprintf(stderr, "[die] %s:%d " fmt "\n", \
+                __func__, __LINE__,##__VA_ARGS__); \
+        exit(1); \
+    } while (0)
+
+#define die_errno(errnum, fmt, ...) \
+    do { \
+        fprintf(stderr, "[die] %s:%d " fmt ": %s\n", \
+                __func__, __LINE__,##__VA_ARGS__, strerror(errnum)); \
+        exit(1); \
+    } while (0)
+
+static void
+usage(int status)
+{
+    puts(USAGE);
+    exit(status);
+}
+
+struct Arguments {
+    bool count;
+    bool help;
+    bool line_number;
+    bool quiet;
+    bool ignore_case;
+    bool invert_match;
+    bool extended_regexp;
+    bool recursive;
+    bool index;
+    bool follow;
+    bool context;           /* -A, -B or -C was given, even as 0 */
+    size_t before_context;
+    size_t after_context;
+    size_t threads;
+};
+
+/* A line of leading context. */
+struct ctx_line {
+    const char *line;
+    size_t len;
+    size_t line_number;
+};
+
+/*
+ * Leading context for -B: a fixed ring of the last NUM lines.  The slots
+ * point into the input, so remembering a line costs no copy and no
+ * allocation.  When the input is streamed the read buffer gets reused, so
+ * before that happens ring_pin() moves the held lines into an arena owned
+ * by the ring.  The arenas only grow when the held lines are longer than
+ * any held before, so memory is bounded by NUM times the longest line.
+ */
+struct ring {
+    struct ctx_line *slots;
+    size_t nslots;
+    size_t head;            /* index of the oldest line */
+    size_t size;
+    char *arena[2];         /* ring_pin() copies from one into the other */
+    size_t arena_cap[2];
+    int cur;
+};
+
+static void *
+mu_malloc(size_t n)
+{
+    void *p;
+
+    p = malloc(n);
+    if (p == NULL)
+        mu_die("out of memory");
+
+    return p;
+}
+
+static void
+ring_init(struct ring *ring, size_t nslots)
+{
+    mu_memzero_p(ring);
+    ring->nslots = nslots;
+    if (nslots > 0)
+        ring->slots = mu_mallocarray(nslots, sizeof(*ring->slots));
+}
+
+/* Return the i-th oldest line held in the ring. */
+static struct ctx_line *
+ring_get(const struct ring *ring, size_t i)
+{
+    i += ring->head;
+    if (i >= ring->nslots)
+        i -= ring->nslots;
+
+    return &ring->slots[i];
+}
+
+/* Remember a line, forgetting the oldest one if the ring is full. */
+static void
+ring_push(struct ring *ring, const char *line, size_t len, size_t line_number)
+{
+    struct ctx_line *slot;
+
+    if (ring->nslots == 0)
+        return;
+
+    if (ring->size < ring->nslots) {
+        slot = ring_get(ring, ring->size++);
+    } else {
+        slot = &ring->slots[ring->head];
+        if (++ring->head == ring->nslots)
+            ring->head = 0;
+    }
+
+    slot->line = line;
+    slot->len = len;
+    slot->line_number = line_number;
+}
+
+/* Copy the held lines into the ring's own memory, so the input can be reused. */
+static void
+ring_pin(struct ring *ring)
+{
+    struct ctx_line *slot;
+    size_t i, need = 0, off = 0;
+    int next = !ring->cur;
+
+    for (i = 0; i < ring->size; i++)
+        need += ring->slots[i].len;
+
+    if (need > ring->arena_cap[next]) {
+        ring->arena_cap[next] = need > 2 * ring->arena_cap[next] ? need : 2 * ring->arena_cap[next];
+        ring->arena[next] = mu_realloc(ring->arena[next], ring->arena_cap[next]);
+    }
+
+    for (i = 0; i < ring->size; i++) {
+        slot = ring_get(ring, i);
+        memcpy(ring->arena[next] + off, slot->line, slot->len);
+        slot->line = ring->arena[next] + off;
+        off += slot->len;
+    }
+
+    ring->cur = next;
+}
+
+static void
+ring_clear(struct ring *ring)
+{
+    ring->head = 0;
+    ring->size = 0;
+}
+
+static void
+ring_deinit(struct ring *ring)
+{
+    free(ring->slots);
+    free(ring->arena[0]);
+    free(ring->arena[1]);
+    mu_memzero_p(ring);
+}
+
+/*
+ * The scan engine.  Rather than splitting the input into lines and testing
+ * each one, we search the whole buffer for STR and only look for the line
+ * boundaries around a hit.  Lines that never match are never split up; with
+ * -n they are only counted.
+ */
+
+#define SCAN_BLOCK_SIZE (1U << 20)  /* read size when the input can't be mmapped */
+#define SCAN_CHUNK_SIZE (8U << 20)  /* -j hands out the file in chunks of about this size */
+#define SCAN_BINARY_PROBE 8192      /* -r: look this far into a file for a nul byte */
+#define SCAN_PREFETCH_SIZE (8U << 20)   /* with several files, read this much of the next one ahead */
+
+/* A selected line, pointing into the mapped file. */
+struct match {
+    const char *bol;
+    const char *eol;
+    size_t line_number;     /* relative to the start of its chunk */
+};
+
+/* 
+ * One newline-aligned piece of the file for -j.  A worker scans it into
+ * its own match buffer; the main thread prints the buffers in file order.
+ */
+struct chunk {
+    const char *buf;
+    size_t len;
+    struct match *matches;
+    size_t nmatches;
+    size_t cap;
+    size_t count;       /* selected lines */
+    size_t lines;       /* lines in the chunk (only counted for -n) */
+    bool done;
+};
+
+struct scan {
+    const char *str;
+    size_t str_len;
+    struct search search;   /* str, compiled */
+    const struct ac *ac;    /* with more than one pattern, match with this instead of str */
+    const struct re *re;    /* for -E */
+    struct re_dfa *dfa;     /* for -E, match with this; each thread has its own */
+    size_t *pattern_counts; /* for -c with more than one pattern, lines matching each one */
+    size_t *pattern_seen;   /* stamp of the last line counted for each pattern */
+    size_t stamp;
+    struct Arguments args;
+    size_t line_number;     /* number of lines consumed so far */
+    size_t count;           /* number of selected lines */
+    bool done;              /* -q found a match; stop reading */
+    bool context;           /* -A, -B or -C: print through the context engine */
+    struct ring ring;       /* leading context */
+    size_t after_left;      /* lines of trailing context still to print */
+    size_t last_printed;    /* line number of the last line printed, or 0 */
+    struct chunk *chunk;    /* for -j, collect selected lines here instead of printing */
+    struct out *out;
+    const char *prefix;     /* for -r, the path printed before each line */
+    bool skip_binary;       /* don't search files that look binary */
+    bool binary;            /* the file looked binary and was skipped */
+    const char *index_path; /* for --index, the file to index */
+    const struct index *index;
+    const char *base;       /* with an index, the start of the mapped file */
+};
+
+/* Return the first hit for STR in [p, end), or NULL. */
+static const char *
+scan_find(const struct scan *scan, const char *p, const char *end)
+{
+    if (scan->dfa != NULL)
+        return re_find(scan->dfa, p, end);
+
+    if (scan->ac != NULL)
+        return ac_find(scan->ac, p, (size_t)(end - p));
+
+    return search_exec(&scan->search, p, (size_t)(end - p));
+}
+
+/* Return a pointer just past the newline that ends the line holding p. */
+static const char *
+line_end(const char *p, const char *end)
+{
+    const char *nl;
+
+    nl = memchr(p, '\n', (size_t)(end - p));
+    return nl == NULL ? end : nl + 1;
+}
+
+/* Return a pointer to the start of the line holding p, looking no further back than lo. */
+static const char *
+line_start(const char *lo, const char *p)
+{
+    const char *nl;
+
+    nl = memrchr(lo, '\n', (size_t)(p - lo));
+    return nl == NULL ? lo : nl + 1;
+}
+
+static size_t
+count_lines(const char *p, const char *end)
+{
+    size_t n = 0;
+
+    while ((p = memchr(p, '\n', (size_t)(end - p))) != NULL) {
+        n++;
+        p++;
+    }
+
+    return n;
+}
+
+/* Print the path and line number before a line; sep is ':' for selected lines, '-' for context. */
+static void
+print_prefix(const struct scan *scan, size_t line_number, char sep)
+{
+    if (scan->prefix != NULL) {
+        out_str(scan->out, scan->prefix);
+        out_char(scan->out, sep);
+    }
+
+    if (scan->args.line_number) {
+        out_num(scan->out, line_number);
+        out_char(scan->out, sep);
+    }
+}
+
+/*
+ * Print a line as it is in the file.  With -r, the output of many files
+ * runs together, so a last line without a newline gets one.
+ */
+static void
+print_text(const struct scan *scan, const char *bol, const char *eol)
+{
+    out_ref(scan->out, bol, (size_t)(eol - bol));
+
+    if (scan->prefix != NULL && eol > bol && eol[-1] != '\n')
+        out_char(scan->out, '\n');
+}
+
+static void
+print_line(const struct scan *scan, const char *bol, const char *eol, size_t line_number)
+{
+    print_prefix(scan, line_number, ':');
+    print_text(scan, bol, eol);
+}
+
+/*
+ * The context engine for -A, -B and -C.  It sees the input the way the
+ * scan loop does: selected lines one at a time, and the runs of unselected
+ * lines between them as whole regions.  From each region it prints the
+ * first after_left lines as trailing context and pushes the last NUM lines
+ * into the ring as leading context for the next selected line; the lines
+ * in between are only counted.  Tracking the last line printed merges
+ * overlapping windows and tells us where a "--" separator goes.
+ */
+
+static void
+ctx_print(struct scan *scan, const char *bol, const char *eol, size_t line_number, char sep)
+{
+    if (scan->last_printed != 0 && line_number > scan->last_printed + 1)
+        out_bytes(scan->out, "--\n", 3);
+
+    print_prefix(scan, line_number, sep);
+    print_text(scan, bol, eol);
+    scan->last_printed = line_number;
+}
+
+/* Print a selected line, preceded by any leading context not yet printed. */
+static void
+ctx_select(struct scan *scan, const char *bol, const char *eol)
+{
+    const struct ctx_line *ctx;
+    size_t i;
+
+    for (i = 0; i < scan->ring.size; i++) {
+        ctx = ring_get(&scan->ring, i);
+        if (ctx->line_number > scan->last_printed)
+            ctx_print(scan, ctx->line, ctx->line + ctx->len, ctx->line_number, '-');
+    }
+
+    ring_clear(&scan->ring);
+    ctx_print(scan, bol, eol, scan->line_number, ':');
+    scan->after_left = scan->args.after_context;
+}
+
+/* Handle [p, q), a run of whole lines that were not selected. */
+static void
+ctx_skip(struct scan *scan, const char *p, const char *q)
+{
+    const char *r = q, *eol;
+    size_t k;
+
+    while (scan->after_left > 0 && p < q) {
+        eol = line_end(p, q);
+        scan->line_number++;
+        ctx_print(scan, p, eol, scan->line_number, '-');
+        scan->after_left--;
+        p = eol;
+    }
+
+    /* walk back from q to the start of the last NUM lines */
+    for (k = 0; k < scan->ring.nslots && r > p; k++)
+        r = line_start(p, r - 1);
+
+    scan->line_number += count_lines(p, r);
+
+    for (; r < q; r = eol) {
+        eol = line_end(r, q);
+        scan->line_number++;
+        ring_push(&scan->ring, r, (size_t)(eol - r), scan->line_number);
+    }
+}
+
+/* Account for [p, q), a run of whole lines that were not selected. */
+static void
+scan_skip(struct scan *scan, const char *p, const char *q)
+{
+    if (scan->context)
+        ctx_skip(scan, p, q);
+    else if (scan->args.line_number && scan->index != NULL)
+        scan->line_number = index_count_lines(scan->index, scan->base, p, q, scan->line_number);
+    else if (scan->args.line_number)
+        scan->line_number += count_lines(p, q);
+}
+
+static void
+chunk_add_match(struct chunk *chunk, const char *bol, const char *eol, size_t line_number)
+{
+    struct match *m;
+
+    if (chunk->nmatches == chunk->cap) {
+        chunk->cap = chunk->cap == 0 ? 64 : chunk->cap * 2;
+        chunk->matches = mu_reallocarray(chunk->matches, chunk->cap, sizeof(*chunk->matches));
+    }
+
+    m = &chunk->matches[chunk->nmatches++];
+    m->bol = bol;
+    m->eol = eol;
+    m->line_number = line_number;
+}
+
+static void
+scan_count_pattern(size_t id, void *arg /* scan */)
+{
+    struct scan *scan = arg;
+
+    if (scan->pattern_seen[id] == scan->stamp)
+        return;
+
+    scan->pattern_seen[id] = scan->stamp;
+    scan->pattern_counts[id]++;
+}
+
+/* 
+ * Handle a selected line.  scan->line_number must already count the line. 
+ */
+static void
+scan_select(struct scan *scan, const char *bol, const char *eol)
+{
+    scan->count++;
+
+    if (scan->args.quiet) {
+        scan->done = true;
+        return;
+    }
+
+    if (scan->args.count) {
+        if (scan->pattern_counts != NULL) {
+            scan->stamp++;
+            ac_foreach(scan->ac, bol, (size_t)(eol - bol), scan_count_pattern, scan);
+        }
+        return;
+    }
+
+    if (scan->chunk != NULL) {
+        chunk_add_match(scan->chunk, bol, eol, scan->line_number);
+        return;
+    }
+
+    if (scan->context) {
+        ctx_select(scan, bol, eol);
+        return;
+    }
+
+    print_line(scan, bol, eol, scan->line_number);
+}
+
+/*
+ * Scan [buf, buf+len) for selected lines.  The buffer must hold whole lines,
+ * except that the last line of the input may lack its newline.
+ */
+static void
+scan_lines(struct scan *scan, const char *buf, size_t len)
+{
+    const char *p = buf, *end = buf + len;
+    const char *hit, *bol, *eol;
+
+    while (p < end && !scan->done) {
+        hit = scan_find(scan, p, end);
+
+        if (!scan->args.invert_match) {
+            if (hit == NULL) {
+                scan_skip(scan, p, end);
+                break;
+            }
+
+            bol = line_start(p, hit);
+            eol = line_end(hit, end);
+
+            scan_skip(scan, p, bol);
+            scan->line_number++;
+
+            scan_select(scan, bol, eol);
+            p = eol;
+        } else {
+            /* every line before the one holding the hit is selected */
+            bol = hit == NULL ? end : line_start(p, hit);
+
+            while (p < bol && !scan->done) {
+                eol = line_end(p, bol);
+                scan->line_number++;
+                scan_select(scan, p, eol);
+                p = eol;
+            }
+
+            if (hit == NULL || scan->done)
+                break;
+
+            eol = line_end(hit, end);
+            scan_skip(scan, bol, eol);
+            p = eol;
+        }
+    }
+}
+
+/*
+ * Parallel scan for -j.  The mapped file is cut into newline-aligned chunks
+ * which a pool of workers scan concurrently.  The main thread prints each
+ * chunk's matches as soon as it and every chunk before it are done, so the
+ * output is the same as a serial run.  Workers may only run a bounded
+ * number of chunks ahead of the printer, which bounds the memory held in
+ * match buffers.
+ */
+struct pscan {
+    struct scan proto;          /* the settings every worker starts from */
+    struct chunk *chunks;
+    size_t nchunks;
+    size_t next;                /* next chunk to hand out */
+    size_t flushed;             /* chunks [0, flushed) have been printed */
+    size_t *pattern_counts;     /* sum of the workers' per-pattern counts */
+    size_t window;              /* max chunks in flight past flushed */
+    bool cancel;                /* -q found a match */
+
+    pthread_mutex_t lock;
+    pthread_cond_t chunk_done;  /* a worker finished a chunk */
+    pthread_cond_t window_open; /* the printer flushed a chunk */
+
+    size_t num_threads;
+    pthread_t *threads;
+};
+
+static void *
+pscan_worker(void *arg /* pscan */)
+{
+    struct pscan *ps = arg;
+    struct chunk *chunk;
+    struct scan scan;
+    struct re_dfa dfa;
+    size_t *pattern_counts = NULL, *pattern_seen = NULL;
+    size_t i, stamp = 0;
+
+    if (ps->pattern_counts != NULL) {
+        pattern_counts = mu_calloc(ps->proto.ac->npatterns, sizeof(*pattern_counts));
+        pattern_seen = mu_calloc(ps->proto.ac->npatterns, sizeof(*pattern_seen));
+    }
+
+    if (ps->proto.re != NULL)
+        re_dfa_init(&dfa, ps->proto.re);
+
+    xpthread_mutex_lock(&ps->lock);
+
+    for (;;) {
+        while (ps->next < ps->nchunks && ps->next >= ps->flushed + ps->window && !ps->cancel)
+            xpthread_cond_wait(&ps->window_open, &ps->lock);
+
+        if (ps->next == ps->nchunks || ps->cancel)
+            break;
+
+        i = ps->next++;
+        xpthread_mutex_unlock(&ps->lock);
+
+        chunk = &ps->chunks[i];
+        scan = ps->proto;
+        scan.chunk = chunk;
+        scan.pattern_counts = pattern_counts;
+        scan.pattern_seen = pattern_seen;
+        scan.stamp = stamp;
+        if (scan.re != NULL)
+            scan.dfa = &dfa;
+        scan_lines(&scan, chunk->buf, chunk->len);
+        chunk->count = scan.count;
+        chunk->lines = scan.line_number;
+        stamp = scan.stamp;
+
+        xpthread_mutex_lock(&ps->lock);
+        chunk->done = true;
+        if (scan.done)
+            ps->cancel = true;
+        xpthread_cond_broadcast(&ps->chunk_done);
+    }
+
+    if (pattern_counts != NULL) {
+        for (i = 0; i < ps->proto.ac->npatterns; i++)
+            ps->pattern_counts[i] += pattern_counts[i];
+    }
+
+    xpthread_mutex_unlock(&ps->lock);
+
+    free(pattern_counts);
+    free(pattern_seen);
+    if (ps->proto.re != NULL)
+        re_dfa_deinit(&dfa);
+
+    return NULL;
+}
+
+/* Cut [buf, buf+len) into chunks of about SCAN_CHUNK_SIZE that end on a newline. */
+static size_t
+pscan_split(struct pscan *ps, const char *buf, size_t len)
+{
+    const char *p = buf, *end = buf + len, *q;
+    size_t n = 0;
+
+    ps->chunks = mu_calloc(len / SCAN_CHUNK_SIZE + 1, sizeof(*ps->chunks));
+
+    while (p < end) {
+        q = (size_t)(end - p) > SCAN_CHUNK_SIZE ? line_end(p + SCAN_CHUNK_SIZE - 1, end) : end;
+        ps->chunks[n].buf = p;
+        ps->chunks[n].len = (size_t)(q - p);
+        n++;
+        p = q;
+    }
+
+    return n;
+}
+
+static void
+pscan_run(struct scan *scan, const char *buf, size_t len)
+{
+    struct pscan ps;
+    struct chunk *chunk;
+    size_t i, j, base = 0;
+
+    memset(&ps, 0, sizeof(ps));
+    ps.proto = *scan;
+    ps.proto.line_number = 0;
+    ps.proto.count = 0;
+    ps.pattern_counts = scan->pattern_counts;
+    ps.nchunks = pscan_split(&ps, buf, len);
+    ps.num_threads = MU_MIN(scan->args.threads, ps.nchunks);
+    ps.window = 2 * ps.num_threads;
+
+    xpthread_mutex_init(&ps.lock, NULL);
+    xpthread_cond_init(&ps.chunk_done, NULL);
+    xpthread_cond_init(&ps.window_open, NULL);
+
+    ps.threads = mu_mallocarray(ps.num_threads, sizeof(pthread_t));
+    for (i = 0; i < ps.num_threads; i++)
+        xpthread_create(&ps.threads[i], NULL, pscan_worker, &ps);
+
+    for (i = 0; i < ps.nchunks; i++) {
+        chunk = &ps.chunks[i];
+
+        xpthread_mutex_lock(&ps.lock);
+        while (!chunk->done && !ps.cancel)
+            xpthread_cond_wait(&ps.chunk_done, &ps.lock);
+        xpthread_mutex_unlock(&ps.lock);
+
+        if (!chunk->done)
+            break;
+
+        /* -n: a chunk's line numbers are offset by the lines in all chunks before it */
+        for (j = 0; j < chunk->nmatches; j++)
+            print_line(scan, chunk->matches[j].bol, chunk->matches[j].eol,
+                    base + chunk->matches[j].line_number);
+
+        scan->count += chunk->count;
+        base += chunk->lines;
+        free(chunk->matches);
+        chunk->matches = NULL;
+
+        xpthread_mutex_lock(&ps.lock);
+        ps.flushed = i + 1;
+        xpthread_cond_broadcast(&ps.window_open);
+        xpthread_mutex_unlock(&ps.lock);
+    }
+
+    xpthread_mutex_lock(&ps.lock);
+    if (ps.cancel) {
+        /* -q: a worker found a match */
+        scan->done = true;
+        scan->count++;
+    }
+
+    /* wake any workers still waiting on the window so they see we're done */
+    ps.cancel = true;
+    xpthread_cond_broadcast(&ps.window_open);
+    xpthread_mutex_unlock(&ps.lock);
+
+    for (i = 0; i < ps.num_threads; i++)
+        xpthread_join(ps.threads[i], NULL);
+
+    for (i = 0; i < ps.nchunks; i++)
+        free(ps.chunks[i].matches);
+
+    xpthread_mutex_destroy(&ps.lock);
+    xpthread_cond_destroy(&ps.chunk_done);
+    xpthread_cond_destroy(&ps.window_open);
+    free(ps.threads);
+    free(ps.chunks);
+}
+
+/*
+ * With skip_binary, check whether the file starting with [buf, buf+len)
+ * looks binary, the way grep does: a nul byte near the start.
+ */
+static bool
+scan_is_binary(struct scan *scan, const char *buf, size_t len)
+{
+    if (scan->skip_binary && memchr(buf, '\0', MU_MIN(len, (size_t)SCAN_BINARY_PROBE)) != NULL)
+        scan->binary = true;
+
+    return scan->binary;
+}
+
+/*
+ * For --index, load the index for the file mapped at [buf, buf+size), or
+ * build it and save it for next time.  Return false if there's no index
+ * to use.
+ */
+static bool
+scan_open_index(struct scan *scan, struct index *ix, int fd, const char *buf, size_t size)
+{
+    int ret;
+
+    ret = index_load(ix, scan->index_path, fd);
+    if (ret == 0)
+        return true;
+
+    ret = index_build(ix, fd, buf, size);
+    if (ret != 0) {
+        mu_stderr_errno(-ret, "sgrep: can't index %s", scan->index_path);
+        return false;
+    }
+
+    ret = index_save(ix, scan->index_path);
+    if (ret != 0)
+        mu_stderr_errno(-ret, "sgrep: can't save the index for %s", scan->index_path);
+
+    return true;
+}
+
+/*
+ * Search [buf, buf+size), the whole of an indexed file.  A plain string
+ * can only occur in the blocks whose trigram bitmaps hold all of its
+ * trigrams, so only the runs of lines around those blocks are scanned.
+ * The lines in between are not selected, and with -n their number comes
+ * from the index.
+ */
+static void
+scan_indexed(struct scan *scan, const char *buf, size_t size)
+{
+    const struct index *ix = scan->index;
+    const char *p = buf, *end = buf + size, *lo, *hi;
+    size_t len = scan->str_len, b, b1;
+
+    if (scan->args.invert_match || scan->context || scan->dfa != NULL || scan->ac != NULL ||
+            len < 3 || len > INDEX_BLOCK_SIZE) {
+        scan_lines(scan, buf, size);
+        return;
+    }
+
+    /* readahead would read the blocks we skip */
+    (void)madvise((void *)buf, size, MADV_NORMAL);
+
+    for (b = 0; b < ix->hdr.nblocks && !scan->done; b = b1 + 1) {
+        b1 = b;
+        if (!index_block_may_contain(ix, b, scan->str, len))
+            continue;
+        while (b1 + 1 < ix->hdr.nblocks && index_block_may_contain(ix, b1 + 1, scan->str, len))
+            b1++;
+
+        /* a hit that starts in blocks b..b1 ends before hi */
+        lo = buf + b * INDEX_BLOCK_SIZE;
+        hi = buf + MU_MIN(size, (b1 + 1) * INDEX_BLOCK_SIZE + len - 1);
+        lo = lo <= p ? p : line_start(p, lo);
+        if (hi <= lo)
+            continue;
+        hi = line_end(hi - 1, end);
+
+        scan_skip(scan, p, lo);
+        scan_lines(scan, lo, (size_t)(hi - lo));
+        p = hi;
+    }
+}
+
+static int scan_stream(struct scan *scan, int fd);
+
+/*
+ * buf holds have bytes that were already there and n that were just read.
+ * Scan the whole lines, and move the partial last line to the front of
+ * buf.  Return the number of bytes left in buf.
+ */
+static size_t
+scan_block(struct scan *scan, char *buf, size_t have, size_t n)
+{
+    char *nl;
+    size_t used;
+
+    nl = memrchr(buf + have, '\n', n);
+    have += n;
+    if (nl == NULL)
+        return have;
+
+    used = (size_t)(nl + 1 - buf);
+    scan_lines(scan, buf, used);
+
+    /* the context ring may point into buf, which we're about to reuse */
+    if (scan->ring.size > 0)
+        ring_pin(&scan->ring);
+
+    /* and so may the output */
+    out_flush(scan->out);
+
+    memmove(buf, buf + used, have - used);
+    return have - used;
+}
+
+/*
+ * Search buf, a mapping of all size bytes of fd, and unmap it.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+scan_mmap(struct scan *scan, int fd, void *buf, size_t size)
+{
+    struct index ix;
+
+    (void)madvise(buf, size, MADV_SEQUENTIAL);
+
+    /* compressed files are decompressed through the streaming path; fd is still at 0 */
+    if (decomp_detect(buf, size) != DECOMP_NONE) {
+        munmap(buf, size);
+        return scan_stream(scan, fd);
+    }
+
+    if (scan_is_binary(scan, buf, size)) {
+        munmap(buf, size);
+        return 0;
+    }
+
+    /*
+     * The context engine carries state from line to line, so it runs
+     * serially.  So does an indexed search, which reads too little of the
+     * file to be worth splitting up.
+     */
+    if (scan->index_path != NULL && scan_open_index(scan, &ix, fd, buf, size)) {
+        scan->index = &ix;
+        scan->base = buf;
+        scan_indexed(scan, buf, size);
+        scan->index = NULL;
+        index_close(&ix);
+    } else if (scan->args.threads > 1 && size > SCAN_CHUNK_SIZE && !scan->context) {
+        pscan_run(scan, buf, size);
+    } else {
+        scan_lines(scan, buf, size);
+    }
+
+    /* the output may still point into the mapping */
+    out_flush(scan->out);
+    munmap(buf, size);
+
+    return 0;
+}
+
+/*
+ * Fallback for pipes, devices, and anything else we can't mmap: read the
+ * input in large blocks and scan the whole lines in each one, carrying the
+ * partial last line over to the next read.
+ *
+ * If the input starts with the magic bytes of a compressed format, the
+ * blocks come from a decompressor thread instead, which works on the next
+ * block while we scan this one.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+scan_stream(struct scan *scan, int fd)
+{
+    struct decomp dc;
+    enum decomp_format format;
+    char *buf;
+    size_t cap = SCAN_BLOCK_SIZE, have = 0;
+    ssize_t n;
+    int ret = 0;
+    bool first = true, compressed = false;
+
+    buf = mu_malloc(cap);
+
+    while (!scan->done) {
+        if (have == cap) {
+            /* a single line longer than the buffer */
+            cap *= 2;
+            buf = mu_realloc(buf, cap);
+        }
+
+        if (compressed) {
+            n = decomp_read(&dc, buf + have, cap - have);
+            if (n < 0) {
+                ret = (int)n;
+                break;
+            }
+        } else {
+            n = read(fd, buf + have, cap - have);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                ret = -errno;
+                break;
+            }
+        }
+
+        if (n == 0) {
+            /* an input shorter than the magic bytes hasn't been checked yet */
+            if (!(first && scan_is_binary(scan, buf, have)))
+                scan_lines(scan, buf, have);
+            break;
+        }
+
+        if (first && !compressed) {
+            /* a pipe may hand over the first few bytes a read at a time */
+            have += (size_t)n;
+            if (have < DECOMP_MAGIC_LEN)
+                continue;
+
+            format = decomp_detect(buf, have);
+            if (format != DECOMP_NONE) {
+                /* what we've read is the start of the compressed input */
+                ret = decomp_open(&dc, fd, format, buf, have);
+                if (ret != 0)
+                    break;
+                compressed = true;
+                have = 0;
+                continue;
+            }
+
+            n = (ssize_t)have;
+            have = 0;
+        }
+
+        if (first) {
+            /* look for binary data in the decompressed input, if it was compressed */
+            if (scan_is_binary(scan, buf, (size_t)n))
+                break;
+            first = false;
+        }
+
+        have = scan_block(scan, buf, have, (size_t)n);
+    }
+
+    if (compressed)
+        decomp_close(&dc);
+
+    out_flush(scan->out);
+    free(buf);
+    return ret;
+}
+
+/*
+ * Set up scan to search for the patterns with the settings in args.  A
+ * single pattern goes through the SIMD search kernels; more than one is
+ * compiled into ac, an Aho-Corasick automaton, so the input is still read
+ * once.  With -E, the patterns are compiled into re instead.  The scan
+ * only reads ac and re, so scans in several threads may share them.
+ */
+static void
+scan_init(struct scan *scan, struct ac *ac, struct re *re, char **patterns,
+        size_t npatterns, struct Arguments args, struct out *out)
+{
+    const char *err;
+    size_t i;
+
+    memset(scan, 0, sizeof(*scan));
+    scan->str = patterns[0];
+    scan->str_len = strlen(patterns[0]);
+    scan->args = args;
+    /* even -C 0 separates non-adjacent matches with "--", as grep does */
+    scan->context = args.context && !args.count && !args.quiet;
+    scan->out = out;
+
+    mu_memzero_p(re);
+    if (args.extended_regexp) {
+        err = re_compile(re, patterns, npatterns, args.ignore_case);
+        if (err != NULL)
+            die("invalid regular expression: %s", err);
+        scan->re = re;
+    }
+
+    search_compile(&scan->search, scan->str, scan->str_len, args.ignore_case);
+
+    ac_init(ac, args.ignore_case);
+    if (npatterns > 1 && !args.extended_regexp) {
+        for (i = 0; i < npatterns; i++)
+            ac_add(ac, patterns[i], strlen(patterns[i]));
+        ac_compile(ac);
+        scan->ac = ac;
+    }
+}
+
+/* Give scan, a copy of a scan set up by scan_init(), its own per-file state. */
+static void
+scan_open(struct scan *scan)
+{
+    ring_init(&scan->ring, scan->context ? scan->args.before_context : 0);
 
-#define die(fmt, ...) \
-    do { \
-        fprintf(stderr, "[die] %s:%d " fmt "\n", \
-                __func__, __LINE__,##__VA_ARGS__); \
-        exit(1); \
-    } while (0)
+    if (scan->re != NULL) {
+        scan->dfa = mu_calloc(1, sizeof(*scan->dfa));
+        re_dfa_init(scan->dfa, scan->re);
+    }
 
-#define die_errno(errnum, fmt, ...) \
-    do { \
-        fprintf(stderr, "[die] %s:%d " fmt ": %s\n", \
-                __func__, __LINE__,##__VA_ARGS__, strerror(errnum)); \
-        exit(1); \
-    } while (0)
+    if (scan->ac != NULL && scan->args.count && !scan->args.invert_match) {
+        scan->pattern_counts = mu_calloc(scan->ac->npatterns, sizeof(*scan->pattern_counts));
+        scan->pattern_seen = mu_calloc(scan->ac->npatterns, sizeof(*scan->pattern_seen));
+    }
+}
+
+/* Reset the per-file state so the scan can search another file. */
+static void
+scan_reset(struct scan *scan)
+{
+    scan->line_number = 0;
+    scan->count = 0;
+    scan->done = false;
+    scan->binary = false;
+    scan->after_left = 0;
+    scan->last_printed = 0;
+    ring_clear(&scan->ring);
+
+    if (scan->pattern_counts != NULL)
+        memset(scan->pattern_counts, 0, scan->ac->npatterns * sizeof(*scan->pattern_counts));
+}
+
+static void
+scan_close(struct scan *scan)
+{
+    free(scan->pattern_counts);
+    free(scan->pattern_seen);
+    ring_deinit(&scan->ring);
+
+    if (scan->dfa != NULL) {
+        re_dfa_deinit(scan->dfa);
+        free(scan->dfa);
+    }
+}
 
 /*
- * On success, return 0 and set val to the parsed value.
+ * Search the open file fd.
+ *
+ * On success, return 0.
  * On failure, return a negative errno value.
  */
 static int
-mu_str_to_long(const char *s, int base, long *val)
+scan_fd(struct scan *scan, int fd)
 {
-    char *endptr;
+    struct stat st;
+    void *buf;
 
-    errno = 0;
-    *val = strtol(s, &endptr, base);
-    if (errno != 0) {
-        /* EINVAL for bad base, or ERANGE for value to big or small */
+    if (fstat(fd, &st) == -1)
         return -errno;
-    }
 
-    if (endptr == s) {
-        /* no digits at all -- not a number */
-        return -EINVAL;
+    /* 
+     * Regular files reporting a size of 0 (e.g., in /proc) may still have
+     * data, so they go through the streaming path too, as do files we
+     * can't map.
+     */
+    if (S_ISREG(st.st_mode) && st.st_size > 0) {
+        buf = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buf != MAP_FAILED)
+            return scan_mmap(scan, fd, buf, (size_t)st.st_size);
     }
 
-    if (*endptr != '\0') {
-        /* trailing garbage */
-        return -EINVAL;
-    }
+    return scan_stream(scan, fd);
+}
 
-    return 0;
+/*
+ * Follow mode for --follow.  After the end of the file, keep the file open
+ * and wait for inotify to report a change, then search only the bytes
+ * appended since.  A partial last line waits in the buffer until the rest
+ * of it arrives.
+ *
+ * Log rotation comes in two kinds, and both are handled:
+ *
+ *  - the file is truncated in place (copytruncate): its size drops below
+ *    what we've read, so we start over from the top;
+ *
+ *  - the file is renamed or deleted and a new one created at path: path
+ *    no longer names the file we have open, so we read the old file to
+ *    the end and then open the new one.
+ *
+ * The parent directory is watched too, since that is where the new file
+ * shows up.  inotify doesn't work everywhere (NFS, for one), so we also
+ * look every FOLLOW_POLL_MS.
+ */
+
+#define FOLLOW_POLL_MS 1000
+#define FOLLOW_FILE_EVENTS (IN_MODIFY | IN_ATTRIB | IN_MOVE_SELF | IN_DELETE_SELF)
+#define FOLLOW_DIR_EVENTS (IN_CREATE | IN_MOVED_TO)
+
+struct follow {
+    const char *path;
+    int fd;
+    off_t off;              /* bytes read from fd */
+    int ino;                /* inotify instance */
+    int wd;                 /* watch on the file, or -1 */
+    char *buf;
+    size_t cap;
+    size_t have;            /* bytes of a partial line in buf */
+};
+
+/* The file starts over: number its lines from 1 again and forget the context. */
+static void
+follow_restart(struct scan *scan)
+{
+    scan->line_number = 0;
+    scan->after_left = 0;
+    scan->last_printed = 0;
+    ring_clear(&scan->ring);
 }
 
 /*
- * On success, return 0 and set val to the parsed value.
+ * Search everything appended to the file since the last call.
+ *
+ * On success, return 0.
  * On failure, return a negative errno value.
  */
 static int
-mu_str_to_int(const char *s, int base, int *val)
+follow_read(struct scan *scan, struct follow *fl)
 {
-    int ret;
-    long tmp;
+    ssize_t n;
 
-    ret = mu_str_to_long(s, base, &tmp);
-    if (ret < 0)
-        return ret;
+    while (!scan->done) {
+        if (fl->have == fl->cap) {
+            fl->cap *= 2;
+            fl->buf = mu_realloc(fl->buf, fl->cap);
+        }
 
-    if (tmp < INT_MIN || tmp > INT_MAX)
-        return -ERANGE;
+        n = read(fl->fd, fl->buf + fl->have, fl->cap - fl->have);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            return -errno;
+        }
+        if (n == 0)
+            break;
+
+        fl->off += n;
+        fl->have = scan_block(scan, fl->buf, fl->have, (size_t)n);
+    }
 
-    *val = (int)tmp;
+    out_flush(scan->out);
     return 0;
 }
 
+/* Wait until inotify reports a change, or FOLLOW_POLL_MS go by. */
 static void
-usage(int status)
+follow_wait(struct follow *fl)
 {
-    puts(USAGE);
-    exit(status);
+    char events[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    struct pollfd pfd = {fl->ino, POLLIN, 0};
+
+    if (poll(&pfd, 1, FOLLOW_POLL_MS) <= 0)
+        return;
+
+    /* what changed doesn't matter; we look at the file either way */
+    while (read(fl->ino, events, sizeof(events)) > 0)
+        ;
 }
 
-struct Arguments {
-    bool count;
-    bool help;
-    bool line_number;
-    bool quiet;
-    bool ignore_case;
-    bool invert_match;
-    size_t before_context;
-};
+/*
+ * If path now names another file, finish the old one and switch to the new
+ * one.  If it names nothing, keep following the old one until it does.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+follow_check_rotated(struct scan *scan, struct follow *fl)
+{
+    struct stat cur, st;
+    int fd, ret;
 
-struct node {
-    struct list_head list;
-    char *line;
-    int line_number;
-};
+    if (fstat(fl->fd, &cur) == -1)
+        return -errno;
 
-struct queue {
-    struct list_head head;
-    size_t size;
-    /* ... any other fields you might want ... */
-};
+    if (stat(fl->path, &st) == -1 || (st.st_dev == cur.st_dev && st.st_ino == cur.st_ino))
+        return 0;
 
-#define mu_die(fmt, ...) \
-    do { \
-        fprintf(stderr, "[die] %s:%d " fmt "\n", \
-                __func__, __LINE__,##__VA_ARGS__); \
-        exit(1); \
-    } while (0)
+    fd = open(fl->path, O_RDONLY);
+    if (fd == -1)
+        return 0;   /* gone again; try on the next change */
 
-static void *
-mu_malloc(size_t n)
-{
-    void *p;
+    /* the rest of the old file, including an unterminated last line */
+    ret = follow_read(scan, fl);
+    if (ret != 0) {
+        close(fd);
+        return ret;
+    }
+    scan_lines(scan, fl->buf, fl->have);
+    out_flush(scan->out);
 
-    p = malloc(n);
-    if (p == NULL)
-        mu_die("out of memory");
+    close(fl->fd);
+    fl->fd = fd;
+    fl->off = 0;
+    fl->have = 0;
+    follow_restart(scan);
 
-    return p;
+    if (fl->wd != -1)
+        inotify_rm_watch(fl->ino, fl->wd);
+    fl->wd = inotify_add_watch(fl->ino, fl->path, FOLLOW_FILE_EVENTS);
+
+    return 0;
 }
 
-static char *
-mu_strdup(const char *s)
+/*
+ * Search fd, the open file at path, and then follow it until -q finds a
+ * match or we're killed.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+scan_follow(struct scan *scan, int fd, const char *path)
 {
-    char *p;
+    struct follow fl;
+    struct stat st;
+    char *dir;
+    int ret;
 
-    p = strdup(s);
-    if (p == NULL)
-        mu_die("out of memory");
+    mu_memzero_p(&fl);
+    fl.path = path;
+    fl.fd = dup(fd);
+    if (fl.fd == -1)
+        return -errno;
+    fl.cap = SCAN_BLOCK_SIZE;
+    fl.buf = mu_malloc(fl.cap);
 
-    return p;
-}
+    fl.ino = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    if (fl.ino == -1) {
+        ret = -errno;
+        goto out;
+    }
 
-static struct node *
-node_new(const char *line, int line_number)
-{
-    struct node *node;
+    /* if a watch can't be added, the poll timeout still picks up changes */
+    fl.wd = inotify_add_watch(fl.ino, path, FOLLOW_FILE_EVENTS);
+    dir = mu_strdup(path);
+    (void)inotify_add_watch(fl.ino, dirname(dir), FOLLOW_DIR_EVENTS);
+    free(dir);
+
+    for (;;) {
+        ret = follow_read(scan, &fl);
+        if (ret != 0 || scan->done)
+            break;
+
+        follow_wait(&fl);
+
+        if (fstat(fl.fd, &st) == -1) {
+            ret = -errno;
+            break;
+        }
+
+        if (st.st_size < fl.off) {
+            /* truncated in place; what's left of a partial line is gone */
+            if (lseek(fl.fd, 0, SEEK_SET) == -1) {
+                ret = -errno;
+                break;
+            }
+            fl.off = 0;
+            fl.have = 0;
+            follow_restart(scan);
+        }
 
-    node = mu_malloc(sizeof(*node));
-    node->line = mu_strdup(line);
-    node->line_number = line_number;
+        ret = follow_check_rotated(scan, &fl);
+        if (ret != 0)
+            break;
+    }
 
-    return node;
+    close(fl.ino);
+out:
+    close(fl.fd);
+    free(fl.buf);
+    return ret;
 }
 
+/* With -r, print the path before a count; counts have no line number, even with -n. */
 static void
-node_free(struct node *node)
+print_path(const struct scan *scan)
 {
-    free(node->line);
-    free(node);
+    if (scan->prefix != NULL) {
+        out_str(scan->out, scan->prefix);
+        out_char(scan->out, ':');
+    }
 }
 
+/* For -c, print the count for the file just searched. */
 static void
-queue_init(struct queue *queue)
+scan_print_count(const struct scan *scan)
 {
-    INIT_LIST_HEAD(&queue->head);
-    queue->size = 0;
+    size_t i;
+
+    if (!scan->args.count || scan->args.quiet)
+        return;
+
+    if (scan->pattern_counts == NULL) {
+        print_path(scan);
+        out_num(scan->out, scan->count);
+        out_char(scan->out, '\n');
+        return;
+    }
+
+    for (i = 0; i < scan->ac->npatterns; i++) {
+        print_path(scan);
+        out_str(scan->out, scan->ac->patterns[i]);
+        out_char(scan->out, ':');
+        out_num(scan->out, scan->pattern_counts[i]);
+        out_char(scan->out, '\n');
+    }
 }
 
-static void
-queue_print(const struct queue *queue, struct Arguments args)
+/*
+ * Open path ("-" is stdin) and start reading the head of it into the page
+ * cache in the background, so its I/O overlaps with the search of the file
+ * before it.  Return the file descriptor, or -1 with errno set.
+ */
+static int
+prefetch_open(const char *path)
+{
+    int fd;
+
+    /* "-" is stdin, so compressed input can be piped in too */
+    if (strcmp(path, "-") == 0)
+        return STDIN_FILENO;
+
+    fd = open(path, O_RDONLY);
+    if (fd != -1)
+        (void)posix_fadvise(fd, 0, SCAN_PREFETCH_SIZE, POSIX_FADV_WILLNEED);
+
+    return fd;
+}
+
+/*
+ * Search each FILE in paths for the patterns and print the results
+ * selected by args.  The patterns are compiled once for all the files.
+ * With more than one file, each line of output is prefixed with the
+ * file's path, and -c ends with a total.
+ *
+ * Return the exit status: 2 if a FILE couldn't be read (unless -q found a
+ * match), 0 if a line was selected, and 1 otherwise.
+ */
+static ssize_t
+read_lines(char **paths, size_t npaths, char **patterns, size_t npatterns,
+        struct Arguments args, struct out *out)
 {
-    struct node *node;
+    struct scan scan;
+    struct ac ac;
+    struct re re;
+    size_t i, total = 0;
+    bool errors = false;
+    int fd, next_fd, ret;
+
+    next_fd = prefetch_open(paths[0]);
+    if (next_fd == -1 && npaths == 1)
+        die("no such file exists");
 
-    if(args.line_number == true) {
-        list_for_each_entry(node, &queue->head, list) {
-            printf("%d:%s", node->line_number, node->line);
+    scan_init(&scan, &ac, &re, patterns, npatterns, args, out);
+    scan_open(&scan);
+
+    for (i = 0; i < npaths && !scan.done; i++) {
+        fd = next_fd;
+        next_fd = i + 1 < npaths ? prefetch_open(paths[i + 1]) : -1;
+        if (fd == -1) {
+            mu_stderr_errno(errno, "sgrep: %s", paths[i]);
+            errors = true;
+            continue;
         }
-    }
-    else {
-        list_for_each_entry(node, &queue->head, list) {
-            printf("%s", node->line);
+
+        scan_reset(&scan);
+        if (npaths > 1)
+            scan.prefix = fd == STDIN_FILENO ? "(standard input)" : paths[i];
+        if (args.index && fd != STDIN_FILENO)
+            scan.index_path = paths[i];
+
+        if (args.follow)
+            ret = scan_follow(&scan, fd, paths[i]);
+        else
+            ret = scan_fd(&scan, fd);
+        if (fd != STDIN_FILENO)
+            close(fd);
+        if (ret != 0) {
+            /* what was found before the error has been printed; go on to the next */
+            mu_stderr_errno(-ret, "sgrep: %s", paths[i]);
+            errors = true;
+            total += scan.count;
+            continue;
         }
+
+        scan_print_count(&scan);
+        total += scan.count;
     }
+
+    if (next_fd != -1 && next_fd != STDIN_FILENO)
+        close(next_fd);
+
+    if (args.count && !args.quiet && npaths > 1) {
+        out_str(out, "total:");
+        out_num(out, total);
+        out_char(out, '\n');
+    }
+
+    scan_close(&scan);
+    search_free(&scan.search);
+    ac_deinit(&ac);
+    re_deinit(&re);
+
+    if (errors && !(args.quiet && total > 0))
+        return 2;
+    return total > 0 ? 0 : 1;
 }
 
-static void
-queue_insert(struct queue *queue, struct node *node)
+/*
+ * Recursive search for -r.  The main thread walks the tree and feeds the
+ * paths of regular files through a bounded queue to a pool of searchers,
+ * so a deep or slow tree never queues more than WALK_QUEUE_SIZE paths.
+ * Each searcher opens, stats, and searches its file into a private buffer,
+ * then writes the buffer out whole, so lines from different files never
+ * interleave.
+ */
+
+#define WALK_QUEUE_SIZE 256
+
+struct walk {
+    const struct scan *proto;   /* the settings every searcher starts from */
+
+    /* circular queue of paths from the walker to the searchers */
+    char **queue;
+    size_t max_queue_size;
+    size_t sidx;
+    size_t eidx;
+    size_t queue_size;
+    bool shutdown;              /* the walker is done; searchers exit once the queue drains */
+    bool cancel;                /* -q found a match; everyone stops */
+
+    pthread_mutex_t queue_lock;
+    pthread_cond_t queue_not_empty;
+    pthread_cond_t queue_not_full;
+
+    struct out *out;
+    pthread_mutex_t out_lock;   /* held while a searcher writes a file's output to out */
+    bool matched;               /* some file had a selected line */
+    bool errors;                /* some file or directory couldn't be read */
+
+    size_t num_threads;
+    pthread_t *threads;
+};
+
+/* Queue path, which the searcher frees.  Return false if the search was cancelled. */
+static bool
+walk_add(struct walk *walk, char *path)
 {
-    list_add_tail(&node->list, &queue->head);
-    queue->size += 1;
+    xpthread_mutex_lock(&walk->queue_lock);
+
+    while (walk->queue_size == walk->max_queue_size && !walk->cancel)
+        xpthread_cond_wait(&walk->queue_not_full, &walk->queue_lock);
+
+    if (walk->cancel) {
+        xpthread_mutex_unlock(&walk->queue_lock);
+        free(path);
+        return false;
+    }
+
+    walk->queue[walk->eidx] = path;
+    walk->eidx = (walk->eidx + 1) % walk->max_queue_size;
+    walk->queue_size++;
+
+    xpthread_cond_signal(&walk->queue_not_empty);
+    xpthread_mutex_unlock(&walk->queue_lock);
+
+    return true;
 }
 
-static struct node *
-queue_remove(struct queue *queue)
+/* Return the next path to search, or NULL when there are no more. */
+static char *
+walk_next(struct walk *walk)
 {
-    struct node *node;
+    char *path = NULL;
+
+    xpthread_mutex_lock(&walk->queue_lock);
 
-    node = list_first_entry_or_null(&queue->head, struct node, list);
-    if (node == NULL)
-        mu_die("queue_remove: empty queue");
+    while (walk->queue_size == 0 && !walk->shutdown && !walk->cancel)
+        xpthread_cond_wait(&walk->queue_not_empty, &walk->queue_lock);
 
-    list_del(&node->list);
-    queue->size -= 1;
+    if (walk->queue_size > 0 && !walk->cancel) {
+        path = walk->queue[walk->sidx];
+        walk->sidx = (walk->sidx + 1) % walk->max_queue_size;
+        walk->queue_size--;
+        xpthread_cond_signal(&walk->queue_not_full);
+    }
+
+    xpthread_mutex_unlock(&walk->queue_lock);
 
-    return node;
+    return path;
 }
 
-static size_t
-queue_size(const struct queue *queue)
+static void
+walk_cancel(struct walk *walk)
 {
-    return queue->size;
+    xpthread_mutex_lock(&walk->queue_lock);
+    walk->cancel = true;
+    xpthread_cond_broadcast(&walk->queue_not_empty);
+    xpthread_cond_broadcast(&walk->queue_not_full);
+    xpthread_mutex_unlock(&walk->queue_lock);
 }
 
+/* Note that a file or directory couldn't be read, for the exit status. */
 static void
-queue_deinit(struct queue *queue)
+walk_error(struct walk *walk)
+{
+    xpthread_mutex_lock(&walk->out_lock);
+    walk->errors = true;
+    xpthread_mutex_unlock(&walk->out_lock);
+}
+
+static void *
+walk_worker(void *arg /* walk */)
 {
-    struct node *node, *tmp;
+    struct walk *walk = arg;
+    struct scan scan;
+    struct out file;
+    char *path;
+    int fd, ret;
+
+    scan = *walk->proto;
+    scan_open(&scan);
+    out_init(&file, -1);
+    scan.out = &file;
+
+    while ((path = walk_next(walk)) != NULL) {
+        fd = open(path, O_RDONLY);
+        if (fd == -1) {
+            mu_stderr_errno(errno, "sgrep: %s", path);
+            walk_error(walk);
+            free(path);
+            continue;
+        }
+
+        out_reset(&file);
+        scan_reset(&scan);
+        scan.prefix = path;
+
+        ret = scan_fd(&scan, fd);
+        if (ret != 0) {
+            mu_stderr_errno(-ret, "sgrep: %s", path);
+            walk_error(walk);
+        } else if (!scan.binary) {
+            scan_print_count(&scan);
+        }
 
-    list_for_each_entry_safe(node, tmp, &queue->head, list) {
-        list_del(&node->list);
-        node_free(node);
+        close(fd);
+
+        xpthread_mutex_lock(&walk->out_lock);
+        out_bytes(walk->out, file.buf, file.len);
+        if (scan.count > 0)
+            walk->matched = true;
+        xpthread_mutex_unlock(&walk->out_lock);
+
+        if (scan.done)
+            walk_cancel(walk);
+
+        free(path);
     }
 
-    queue->size = 0;
+    out_deinit(&file);
+    scan_close(&scan);
+
+    return NULL;
+}
+
+static char *
+path_join(const char *dir, const char *name)
+{
+    size_t dlen = strlen(dir), nlen = strlen(name);
+    char *path;
+
+    /* don't double up the slash in "sgrep -r STR dir/" */
+    if (dlen > 0 && dir[dlen - 1] == '/')
+        dlen--;
+
+    path = mu_calloc(1, dlen + nlen + 2);
+    memcpy(path, dir, dlen);
+    path[dlen] = '/';
+    memcpy(path + dlen + 1, name, nlen);
+
+    return path;
 }
 
 /*
- * On success, return the number of lines read.
- * On failure, return a negative errno value.
+ * Queue every regular file under dir.  Symbolic links are not followed,
+ * so the walk can't loop; devices, fifos, and sockets are skipped, since
+ * reading them may block or never end.
+ *
+ * Return false if the search was cancelled.
  */
-static ssize_t
-read_lines(const char *path, const char *str, struct Arguments args)
+static bool
+walk_dir(struct walk *walk, const char *dir)
 {
-    FILE *fh;
-    ssize_t len = 0;
-    size_t n = 0;
-    char *line = NULL;
-    ssize_t ret = 0;
-
-    fh = fopen(path, "r");
-    if (fh == NULL) {
-        ret = -errno;
-        die("no such file exists");
-        goto out;
+    struct dirent *ent;
+    struct stat st;
+    unsigned char type;
+    char *path;
+    bool more = true;
+    DIR *dp;
+
+    dp = opendir(dir);
+    if (dp == NULL) {
+        mu_stderr_errno(errno, "sgrep: %s", dir);
+        walk_error(walk);
+        return true;
     }
 
-    //--count
-    int count = 0;    
-    if(args.count == true) {
-        while (1) {
-            errno = 0;
-            len = getline(&line, &n, fh);
-            if (len == -1) {
-                if (errno != 0)
-                    ret = -errno;
+    while (more && (ent = readdir(dp)) != NULL) {
+        if (strcmp(ent->d_name, ".") == 0 || strcmp(ent->d_name, "..") == 0)
+            continue;
 
-                printf("%d\n", count);
-                ret = (count > 0) ? 0 : 1;
-                goto out;
-            }
+        path = path_join(dir, ent->d_name);
 
-            if(strstr(line, str)) {
-                count++;
+        /* not every filesystem fills in d_type */
+        type = ent->d_type;
+        if (type == DT_UNKNOWN) {
+            if (lstat(path, &st) == -1) {
+                mu_stderr_errno(errno, "sgrep: %s", path);
+                walk_error(walk);
+                free(path);
+                continue;
             }
+            type = S_ISDIR(st.st_mode) ? DT_DIR : S_ISREG(st.st_mode) ? DT_REG : DT_UNKNOWN;
         }
-    }
 
-    //--quiet
-    if(args.quiet == true) {
-        while (1) {
-            errno = 0;
-            len = getline(&line, &n, fh);
-            if (len == -1) {
-                if (errno != 0)
-                    ret = -errno;
-                
-                ret = 1;
-                goto out;
-            }
-            
-            if(strstr(line, str)) {
-                ret = 0;
-                goto out;
-            }
+        if (type == DT_DIR) {
+            more = walk_dir(walk, path);
+            free(path);
+        } else if (type == DT_REG) {
+            more = walk_add(walk, path);
+        } else {
+            free(path);
         }
     }
 
-    //--ignore-case
-    if(args.ignore_case == true) {
-        while (1) {
-            errno = 0;
-            len = getline(&line, &n, fh);
-            if (len == -1) {
-                if (errno != 0)
-                    ret = -errno;
-                
-                ret = 0;
-                goto out;
-            }
+    closedir(dp);
 
-            if(strcasestr(line, str)) {
-                args.line_number == true ? printf("%zd:%s", ret+1, line) : printf("%s", line);
-            }
+    return more;
+}
 
-            ret++;
-        }
+/*
+ * Search every regular file under root.  The pool has args.threads
+ * searchers; each file is searched by one of them.
+ *
+ * Return the exit status: 2 if a file or directory couldn't be read (unless
+ * -q found a match), 0 if a line was selected in any file, and 1 otherwise.
+ */
+static ssize_t
+read_tree(char **roots, size_t nroots, char **patterns, size_t npatterns,
+        struct Arguments args, struct out *out)
+{
+    struct scan proto;
+    struct walk walk;
+    struct stat st;
+    struct ac ac;
+    struct re re;
+    size_t i;
+
+    for (i = 0; i < nroots; i++) {
+        if (stat(roots[i], &st) == -1)
+            die_errno(errno, "can't stat \"%s\"", roots[i]);
     }
 
-    //--invert-match
-    if(args.invert_match == true) {
-        while (1) {
-            errno = 0;
-            len = getline(&line, &n, fh);
-            if (len == -1) {
-                if (errno != 0)
-                    ret = -errno;
-                
-                ret = 1;
-                goto out;
-            }
-            
-            if(!strstr(line, str)) {
-                args.line_number == true ? printf("%zd:%s", ret+1, line) : printf("%s", line);
-            }
-
-            ret++;
-        }
+    scan_init(&proto, &ac, &re, patterns, npatterns, args, out);
+    proto.skip_binary = true;
+
+    memset(&walk, 0, sizeof(walk));
+    walk.proto = &proto;
+    walk.out = out;
+    walk.max_queue_size = WALK_QUEUE_SIZE;
+    walk.queue = mu_mallocarray(walk.max_queue_size, sizeof(*walk.queue));
+    walk.num_threads = args.threads;
+
+    xpthread_mutex_init(&walk.queue_lock, NULL);
+    xpthread_cond_init(&walk.queue_not_empty, NULL);
+    xpthread_cond_init(&walk.queue_not_full, NULL);
+    xpthread_mutex_init(&walk.out_lock, NULL);
+
+    walk.threads = mu_mallocarray(walk.num_threads, sizeof(pthread_t));
+    for (i = 0; i < walk.num_threads; i++)
+        xpthread_create(&walk.threads[i], NULL, walk_worker, &walk);
+
+    for (i = 0; i < nroots; i++) {
+        if (stat(roots[i], &st) == 0 && S_ISDIR(st.st_mode))
+            walk_dir(&walk, roots[i]);
+        else
+            walk_add(&walk, mu_strdup(roots[i]));
     }
 
-    struct queue queue;
-    struct node *node;
+    xpthread_mutex_lock(&walk.queue_lock);
+    walk.shutdown = true;
+    xpthread_cond_broadcast(&walk.queue_not_empty);
+    xpthread_mutex_unlock(&walk.queue_lock);
 
-    queue_init(&queue);
+    for (i = 0; i < walk.num_threads; i++)
+        xpthread_join(walk.threads[i], NULL);
 
-    //--before-context NUM
-    if(args.before_context > 0) {
-        while (1) {
-            errno = 0;
-            len = getline(&line, &n, fh);
-            if (len == -1) {
-                if (errno != 0)
-                    ret = -errno;
+    /* paths left behind by a cancelled search */
+    for (; walk.queue_size > 0; walk.queue_size--) {
+        free(walk.queue[walk.sidx]);
+        walk.sidx = (walk.sidx + 1) % walk.max_queue_size;
+    }
 
-                queue_deinit(&queue);
-                goto out;
-            }
+    xpthread_mutex_destroy(&walk.queue_lock);
+    xpthread_cond_destroy(&walk.queue_not_empty);
+    xpthread_cond_destroy(&walk.queue_not_full);
+    xpthread_mutex_destroy(&walk.out_lock);
+    free(walk.threads);
+    free(walk.queue);
+    search_free(&proto.search);
+    ac_deinit(&ac);
+    re_deinit(&re);
+
+    if (walk.errors && !(args.quiet && walk.matched))
+        return 2;
+    return walk.matched ? 0 : 1;
+}
 
-            node = node_new(line, ret+1);
+struct pattern_list {
+    char **v;
+    size_t n;
+};
 
-            //we have found our target 
-            if(strstr(line, str)) {
-                queue_print(&queue, args);
-                args.line_number == true ? printf("%zd:%s", ret+1, line) : printf("%s", line);
-            }
+static void
+pattern_list_add(struct pattern_list *list, const char *pattern)
+{
+    list->v = mu_reallocarray(list->v, list->n + 1, sizeof(*list->v));
+    list->v[list->n++] = mu_strdup(pattern);
+}
 
-            //we have not reached the before_context threshold in items yet
-            if(queue_size(&queue) < args.before_context)
-                queue_insert(&queue, node);
-            else {
-                queue_remove(&queue);
-                queue_insert(&queue, node);
-            }
+/* Add each line of path, without its newline, as a pattern. */
+static void
+pattern_list_read(struct pattern_list *list, const char *path)
+{
+    FILE *fh;
+    size_t n = 0;
+    ssize_t len = 0;
+    char *line = NULL;
 
-            ret++;
-        }
-    }
+    fh = fopen(path, "r");
+    if (fh == NULL)
+        die_errno(errno, "can't open \"%s\"", path);
 
-    //--line-number
-    if(args.line_number == true) {
-        while (1) {
-            errno = 0;
-            len = getline(&line, &n, fh);
-            if (len == -1) {
-                if (errno != 0)
-                    ret = -errno;
-                
-                ret = 0;
-                goto out;
-            }
-            
-            if(strstr(line, str)) {
-                printf("%zd:%s", ret+1, line);
-            }
-            ret++;
+    while (1) {
+        errno = 0;
+        len = getline(&line, &n, fh);
+        if (len == -1) {
+            if (errno != 0)
+                die_errno(errno, "error reading \"%s\"", path);
+            break;
         }
+
+        mu_str_chomp(line);
+        pattern_list_add(list, line);
     }
 
-out:
     free(line);
-    if (fh != NULL)
-        fclose(fh);
+    fclose(fh);
+}
 
-    return ret;
+static void
+pattern_list_free(struct pattern_list *list)
+{
+    size_t i;
+
+    for (i = 0; i < list->n; i++)
+        free(list->v[i]);
+
+    free(list->v);
 }
 
 int
@@ -417,7 +1857,12 @@ main(int argc,char *argv[])
      * An option that takes a required argument is followed by a ':'.
      * The leading ':' suppresses getopt_long's normal error handling.
      */
-    const char *short_opts = ":chnqivB:";
+    const char *short_opts = ":chnqivErFA:B:C:j:e:f:";
+    /* long options without a short form */
+    enum {
+        OPT_INDEX = CHAR_MAX + 1,
+        OPT_ENGINE,
+    };
     struct option long_opts[] = {
         {"count", no_argument, NULL, 'c'},
         {"help", no_argument, NULL, 'h'},
@@ -425,14 +1870,29 @@ main(int argc,char *argv[])
         {"quiet", no_argument, NULL, 'q'},
         {"ignore-case", no_argument, NULL, 'i'},
         {"invert-match", no_argument, NULL, 'v'},
+        {"extended-regexp", no_argument, NULL, 'E'},
+        {"recursive", no_argument, NULL, 'r'},
+        {"index", no_argument, NULL, OPT_INDEX},
+        {"follow", no_argument, NULL, 'F'},
+        {"engine", required_argument, NULL, OPT_ENGINE},   /* undocumented: for benchmarks */
+        {"after-context", required_argument, NULL, 'A'},
         {"before-context", required_argument, NULL, 'B'},
+        {"context", required_argument, NULL, 'C'},
+        {"threads", required_argument, NULL, 'j'},
+        {"pattern", required_argument, NULL, 'e'},
+        {"file", required_argument, NULL, 'f'},
         {NULL, 0, NULL, 0}
     };
 
-    struct Arguments arguments = {false, false, false, false, false, false, 0};
+    struct Arguments arguments = {false, false, false, false, false, false, false, false, false, false, false, 0, 0, 1};
 
     int before_context = -1;
+    int after_context = -1;
+    int context = 0;
+    int threads = 0;
     int ret = 0;
+    struct pattern_list patterns = {NULL, 0};
+    struct out out;
     ssize_t EXIT_STATUS = 0;
     
     while (1) {
@@ -462,12 +1922,53 @@ main(int argc,char *argv[])
         case 'v':
             arguments.invert_match = true;
             break;
+        case 'E':
+            arguments.extended_regexp = true;
+            break;
+        case 'r':
+            arguments.recursive = true;
+            break;
+        case OPT_INDEX:
+            arguments.index = true;
+            break;
+        case 'F':
+            arguments.follow = true;
+            break;
+        case OPT_ENGINE:
+            if (search_force_engine(optarg) != 0)
+                die("invalid value for --engine: \"%s\"", optarg);
+            break;
+        case 'A':
+            ret = mu_str_to_int(optarg, 10, &after_context);
+            if (ret != 0 || after_context < 0)
+                die_errno(ret != 0 ? -ret : EINVAL, "invalid value for --after-context: \"%s\"", optarg);
+            arguments.context = true;
+            break;
         case 'B':
             ret = mu_str_to_int(optarg, 10, &before_context);
+            if (ret != 0 || before_context < 0)
+                die_errno(ret != 0 ? -ret : EINVAL, "invalid value for --before-context: \"%s\"", optarg);
+            arguments.context = true;
+            break;
+        case 'C':
+            ret = mu_str_to_int(optarg, 10, &context);
+            if (ret != 0 || context < 0)
+                die_errno(ret != 0 ? -ret : EINVAL, "invalid value for --context: \"%s\"", optarg);
+            arguments.context = true;
+            break;
+        case 'j':
+            ret = mu_str_to_int(optarg, 10, &threads);
             if (ret != 0)
-                die_errno(-ret, "invalid value for --before-context: \"%s\"", optarg);
+                die_errno(-ret, "invalid value for --threads: \"%s\"", optarg);
 
-            arguments.before_context = before_context;
+            if (threads < 1)
+                die("--threads must be greater than 0");
+            break;
+        case 'e':
+            pattern_list_add(&patterns, optarg);
+            break;
+        case 'f':
+            pattern_list_read(&patterns, optarg);
             break;
         case '?':
             die("unknown option '%c' (decimal: %d)", optopt, optopt);
@@ -484,11 +1985,51 @@ main(int argc,char *argv[])
      * optind is the index in argv of the first non-option (that is, the first
      * positional argument).
      */
+    /* an explicit -A or -B overrides -C, whatever the order */
+    arguments.after_context = (size_t)(after_context >= 0 ? after_context : context);
+    arguments.before_context = (size_t)(before_context >= 0 ? before_context : context);
+
+    /* -r searches one file per thread, so by default it uses every CPU */
+    if (threads > 0)
+        arguments.threads = (size_t)threads;
+    else if (arguments.recursive && sysconf(_SC_NPROCESSORS_ONLN) > 1)
+        arguments.threads = (size_t)sysconf(_SC_NPROCESSORS_ONLN);
+
+    /* -c wins over -q, as it always has: the count is still printed */
+    if (arguments.count)
+        arguments.quiet = false;
+
+    if (arguments.recursive && arguments.index)
+        die("--index can't be used with -r");
+    if (arguments.follow && (arguments.recursive || arguments.count || arguments.index))
+        die("--follow can't be used with -r, -c or --index");
+
     nargs = argc - optind;
-    if (nargs != 2)
-        die("expected two positional arguments, but found %d", nargs);
+    if (patterns.n == 0) {
+        if (nargs < 2)
+            die("expected STR and at least one FILE, but found %d positional arguments", nargs);
+        pattern_list_add(&patterns, argv[optind]);
+        optind++;
+        nargs--;
+    } else if (nargs < 1) {
+        die("expected at least one FILE with -e or -f");
+    }
 
-    EXIT_STATUS = read_lines(argv[argc-1], argv[argc-2], arguments);
+    if (arguments.follow && (nargs != 1 || strcmp(argv[optind], "-") == 0))
+        die("--follow needs exactly one FILE, not stdin");
+
+    search_init();
+    out_init(&out, STDOUT_FILENO);
+    if (arguments.recursive)
+        EXIT_STATUS = read_tree(argv + optind, (size_t)nargs, patterns.v, patterns.n, arguments, &out);
+    else
+        EXIT_STATUS = read_lines(argv + optind, (size_t)nargs, patterns.v, patterns.n, arguments, &out);
+
+    ret = out_flush(&out);
+    if (ret != 0)
+        die_errno(-ret, "error writing output");
+    out_deinit(&out);
+    pattern_list_free(&patterns);
     //printf("ignore_case: %s\n", ignore_case ? "true" : "false");
     //printf("max_count: %d\n", max_count);
     //printf("PATTERN: \"%s\"\n", argv[optind]);
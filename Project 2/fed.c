@@ -1,5 +1,8 @@
 #define _GNU_SOURCE
 
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 
@@ -14,10 +17,14 @@
 #include <unistd.h>
 #include <ctype.h>
 
+#include <linux/fs.h>
+
 #include "mu.h"
+#include "pmove.h"
+#include "uring.h"
 
 #define USAGE \
-    "Usage: fed [-s START] [-e END] [-r] [-k] FILE \n" \
+    "Usage: fed [-s START] [-e END] [-r] [-k] [-x] [-i STR] [-f SCRIPT] [-a] [-j N] [-m] FILE \n" \
     "\n" \
     "The fed editor either prints or modifies FILE according to an operation, which the user gives as an operation.\n" \
     "\n" \
@@ -36,8 +43,17 @@
     "       Keep the bytes in the file from indices [START, END), and removes all others. These kept bytes are shifted down to index 0. The file's new size is (END - START).\n" \
     "   -x, --expunge\n" \
     "       Overwrite the bytes in the file ffrom indices [START, END) with * characters. The file size does not change.\n" \
-    "   -i, --insert\n" \
+    "   -i STR, --insert STR\n" \
     "       Insert the STR into the file at index START, shifting the existing bytes up. The file's new size is (FSIZE + strlen(STR)).\n" \
+    "\n" \
+    "   -f SCRIPT, --script SCRIPT\n" \
+    "       Apply every edit in SCRIPT, one per line, in a single pass. A line is \"remove START END\", \"keep START END\", \"expunge START END\" or \"insert START STR\" (or r, k, x, i), where START and END are offsets in FILE as it is now; blank lines and lines starting with # are ignored. Removed bytes win over expunged ones; with any keep, only the bytes in some kept range survive; insertions at one offset go in script order. The result replaces FILE as with --atomic.\n" \
+    "   -a, --atomic\n" \
+    "       Write the edited file next to FILE and rename it over FILE, so FILE is never seen half-edited, even if fed is killed.\n" \
+    "   -j N, --jobs N\n" \
+    "       Move bytes within FILE with N threads at once, for large files on storage one thread can't keep busy. Ignored with --mmap.\n" \
+    "   -m, --mmap\n" \
+    "       Move bytes within FILE by mapping it and moving them in memory, rather than by reading and writing them.\n" \
 
 #define die(fmt, ...) \
     do { \
@@ -59,6 +75,48 @@
 #define CMD_EXPUNGE 1U<<2
 #define CMD_INSERT  1U<<3
 
+#define FED_BUF_SIZE    (1U << 20)  /* bytes moved per read/write */
+#define FED_BUF_ALIGN   4096        /* page-aligned, for O_DIRECT and the page cache */
+#define FED_MAP_WINDOW  (64U << 20) /* bytes memmove()d between madvise() calls */
+#define FED_URING_MIN   (4U << 20)  /* moves smaller than this aren't worth a ring */
+
+/* How bytes are moved within the file; see move_range(). */
+enum engine {
+    ENGINE_COPY,    /* copy_file_range(), or pread() and pwrite() */
+    ENGINE_MMAP,    /* memmove() in a shared mapping */
+};
+
+static enum engine engine = ENGINE_COPY;
+static int jobs = 1;        /* threads for the copy engine; see pmove() */
+
+/*
+ * One piece of an edited file, for the edits that build a new file rather
+ * than changing the old one in place: len bytes of the original starting
+ * at off, of data, or of the byte fill.
+ */
+struct piece {
+    enum { PIECE_FILE, PIECE_DATA, PIECE_FILL } kind;
+    off_t off;
+    off_t len;
+    const char *data;
+    char fill;
+};
+
+/* A line of a -f script. */
+struct edit {
+    unsigned int cmd;
+    off_t start;
+    off_t end;
+    char *str;      /* for CMD_INSERT */
+    size_t line;
+};
+
+/* A half-open range of the original file. */
+struct range {
+    off_t start;
+    off_t end;
+};
+
 static void
 usage(int status)
 {
@@ -80,8 +138,90 @@ file_size(const char *path)
     return ret == -1 ? -errno : statbuf.st_size;
 }
 
+static void *
+buf_alloc(void)
+{
+    void *buf;
+    int ret;
+
+    ret = posix_memalign(&buf, FED_BUF_ALIGN, FED_BUF_SIZE);
+    if (ret != 0)
+        mu_die_errno(ret, "can't allocate a %u-byte buffer", FED_BUF_SIZE);
+
+    return buf;
+}
+
 /*
- * The print method corresponding to -p or --print 
+ * Copy len bytes at offset off in fd to out through a buffer, for when the
+ * kernel can't do it for us.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+copy_out_buffered(int fd, off_t off, int out, off_t len)
+{
+    char *buf;
+    size_t want, got;
+    int ret = 0;
+
+    buf = buf_alloc();
+
+    while (len > 0) {
+        want = (size_t)MU_MIN(len, (off_t)FED_BUF_SIZE);
+        ret = mu_pread_n(fd, buf, want, off, &got);
+        if (ret != 0)
+            break;
+        if (got != want) {
+            ret = -EIO;
+            break;
+        }
+
+        ret = mu_write_n(out, buf, want, NULL);
+        if (ret != 0)
+            break;
+
+        off += (off_t)want;
+        len -= (off_t)want;
+    }
+
+    free(buf);
+    return ret;
+}
+
+/* What stdout is, which decides how bytes get to it. */
+enum sink {
+    SINK_PIPE,      /* splice() */
+    SINK_FILE,      /* copy_file_range() */
+    SINK_TTY,       /* a terminal: plain writes */
+    SINK_OTHER,     /* a socket or device: sendfile() */
+};
+
+static enum sink
+stdout_sink(void)
+{
+    struct stat st;
+
+    if (isatty(STDOUT_FILENO))
+        return SINK_TTY;
+    if (fstat(STDOUT_FILENO, &st) == -1)
+        return SINK_TTY;
+    if (S_ISFIFO(st.st_mode))
+        return SINK_PIPE;
+    if (S_ISREG(st.st_mode))
+        return SINK_FILE;
+
+    return SINK_OTHER;
+}
+
+/*
+ * The print method corresponding to -p or --print.  Unless stdout is a
+ * terminal, the bytes go from the page cache to it without passing through
+ * user space: spliced into a pipe, copied (or reflinked) into a file, or
+ * sent to anything else.  Whatever the kernel won't do (a file opened with
+ * O_APPEND, say, or a pipe on an old kernel) falls back to large buffered
+ * writes, from wherever it got to.
+ *
  * output: returns 0 on success, -1 on failure
  */
 static int
@@ -89,55 +229,404 @@ fprint(const char *path, long start, long end)
 {
     int ret = 0;
     int fd;
-    off_t off;
-    char buf[1] = {0};
-    long left = end - start;
-    size_t want = 0;
+    off_t off = start;
+    off_t left = end - start;
     ssize_t n = 0;
+    enum sink sink = stdout_sink();
 
     fd = open(path, O_RDONLY);
     if (fd == -1) {
-        ret = -1;
         mu_stderr_errno(errno, "%s", path);
-        goto out;
+        return -1;
     }
 
-    off = lseek(fd, start, SEEK_SET);
-    if (off == -1) {
-        ret = -1;
-        mu_stderr_errno(errno, "lseek");
-        goto out;
-    }
+    if (sink != SINK_TTY)
+        (void)posix_fadvise(fd, off, left, POSIX_FADV_SEQUENTIAL);
+
+    while (left > 0 && sink != SINK_TTY) {
+        switch (sink) {
+        case SINK_PIPE:
+            n = splice(fd, &off, STDOUT_FILENO, NULL, (size_t)left, SPLICE_F_MORE);
+            break;
+        case SINK_FILE:
+            n = copy_file_range(fd, &off, STDOUT_FILENO, NULL, (size_t)left, 0);
+            break;
+        default:
+            n = sendfile(STDOUT_FILENO, fd, &off, (size_t)left);
+            break;
+        }
 
-    want = MU_MIN(sizeof(buf), (size_t)left);
-    while (want) {
-        n = read(fd, buf, want);
         if (n == -1) {
+            if (errno == EINTR)
+                continue;
+
+            /* stdout doesn't support it; off is unchanged */
+            if (errno == EINVAL || errno == ENOSYS || errno == EXDEV ||
+                    errno == EBADF || errno == EOPNOTSUPP) {
+                sink = SINK_TTY;
+                break;
+            }
+
+            mu_stderr_errno(errno, "error copying \"%s\" to stdout", path);
             ret = -1;
-            mu_stderr_errno(errno, "error reading %zu bytes from \"%s\"", want, path);
-            goto out;
+            break;
         }
         if (n == 0)
             break;
 
-        ret = mu_write_n(STDOUT_FILENO, buf, (size_t)n, NULL);
+        left -= n;
+    }
+
+    if (ret == 0 && left > 0 && sink == SINK_TTY) {
+        ret = copy_out_buffered(fd, off, STDOUT_FILENO, left);
         if (ret != 0) {
-            mu_stderr_errno(-ret, "error writing to stdout");
+            mu_stderr_errno(-ret, "error copying \"%s\" to stdout", path);
             ret = -1;
-            goto out;
         }
+    }
 
-        left -= n;
-        want = MU_MIN((size_t)left, sizeof(buf));
+    close(fd);
+    return ret;
+}
+
+/*
+ * Whether shift_down() and shift_up() should hand the move to uring_move().
+ * Page-aligned moves can bypass the page cache, and then it's the device,
+ * not memcpy(), that's the bottleneck: keep it busy with several chunks in
+ * flight at once, if the kernel has io_uring.
+ *
+ * On ext4 and XFS, collapse_range() and insert_range() get the first go at
+ * any edit whose length is a multiple of the block size, and remap extents
+ * instead of moving bytes; so in practice the io_uring mover only runs on
+ * filesystems that can't, or whose blocks are bigger than a page.
+ */
+static bool
+page_aligned(off_t dst, off_t src, off_t len)
+{
+    return dst % FED_BUF_ALIGN == 0 && src % FED_BUF_ALIGN == 0 && len % FED_BUF_ALIGN == 0;
+}
+
+/*
+ * Move the len bytes at src down to dst (dst < src) within fd, front to
+ * back, so nothing is overwritten before it's read.
+ *
+ * copy_file_range() does the copy in the kernel (or, on filesystems that
+ * support it, by sharing extents), but it refuses overlapping ranges, so
+ * each call moves at most (src - dst) bytes.  When that distance is small,
+ * or the filesystem can't do it, a large buffer is the better tool.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+shift_down(int fd, off_t dst, off_t src, off_t len)
+{
+    off_t gap = src - dst;
+    ssize_t n;
+    char *buf;
+    size_t want, got;
+    int ret = 0;
+
+    while (len > 0 && gap >= (off_t)FED_BUF_SIZE) {
+        n = copy_file_range(fd, &src, fd, &dst, (size_t)MU_MIN(len, gap), 0);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            /* not on this filesystem; src and dst are unchanged */
+            if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)
+                break;
+            return -errno;
+        }
+        if (n == 0)
+            return -EIO;    /* the file shrank under us */
+
+        len -= n;
     }
 
-out:
-    if (fd != -1)
-        close(fd);
+    if (len == 0)
+        return 0;
+
+    /* see page_aligned() */
+    if (len >= (off_t)FED_URING_MIN && page_aligned(dst, src, len)) {
+        ret = uring_move(fd, dst, src, len);
+        if (ret != -ENOSYS)
+            return ret;
+    }
+
+    buf = buf_alloc();
+
+    while (len > 0) {
+        want = (size_t)MU_MIN(len, (off_t)FED_BUF_SIZE);
+        ret = mu_pread_n(fd, buf, want, src, &got);
+        if (ret != 0)
+            break;
+        if (got != want) {
+            ret = -EIO;
+            break;
+        }
+
+        ret = mu_pwrite_n(fd, buf, want, dst, NULL);
+        if (ret != 0)
+            break;
+
+        src += (off_t)want;
+        dst += (off_t)want;
+        len -= (off_t)want;
+    }
+
+    free(buf);
+    return ret;
+}
+
+/*
+ * Move the len bytes at src up to dst (dst > src) within fd, back to front,
+ * so nothing is overwritten before it's read.  The file must already reach
+ * dst + len.  As with shift_down(), copy_file_range() is used when the
+ * distance allows it.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+shift_up(int fd, off_t dst, off_t src, off_t len)
+{
+    off_t gap = dst - src;
+    off_t from, to, chunk;
+    ssize_t n;
+    char *buf;
+    size_t want, got;
+    int ret = 0;
+    bool cfr = gap >= (off_t)FED_BUF_SIZE;
+
+    while (len > 0 && cfr) {
+        /* the last chunk that doesn't overlap where it's going */
+        chunk = MU_MIN(len, gap);
+        from = src + len - chunk;
+        to = dst + len - chunk;
+
+        while (from < src + len) {
+            n = copy_file_range(fd, &from, fd, &to, (size_t)(src + len - from), 0);
+            if (n == -1) {
+                if (errno == EINTR)
+                    continue;
+                /* redo the whole chunk through the buffer; its source is intact */
+                if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP) {
+                    cfr = false;
+                    break;
+                }
+                return -errno;
+            }
+            if (n == 0)
+                return -EIO;    /* the file shrank under us */
+        }
+
+        if (cfr)
+            len -= chunk;
+    }
+
+    if (len == 0)
+        return 0;
+
+    /* see page_aligned() */
+    if (len >= (off_t)FED_URING_MIN && page_aligned(dst, src, len)) {
+        ret = uring_move(fd, dst, src, len);
+        if (ret != -ENOSYS)
+            return ret;
+    }
+
+    buf = buf_alloc();
+
+    while (len > 0) {
+        want = (size_t)MU_MIN(len, (off_t)FED_BUF_SIZE);
+        ret = mu_pread_n(fd, buf, want, src + len - (off_t)want, &got);
+        if (ret != 0)
+            break;
+        if (got != want) {
+            ret = -EIO;
+            break;
+        }
+
+        ret = mu_pwrite_n(fd, buf, want, dst + len - (off_t)want, NULL);
+        if (ret != 0)
+            break;
+
+        len -= (off_t)want;
+    }
 
+    free(buf);
     return ret;
 }
 
+/*
+ * Move the len bytes at src to dst within fd by mapping both ranges and
+ * memmove()ing between them.  dst may be above or below src, as long as the
+ * file already reaches dst + len.
+ *
+ * The move is done a window at a time, in the order that doesn't overwrite
+ * bytes before they're read (front to back when moving down, back to front
+ * when moving up), and the pages that are done with are dropped from the
+ * mapping as it goes, so a multi-GB move doesn't pin a multi-GB working set.
+ * The dirty pages stay in the page cache and are written back as usual.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+map_move(int fd, off_t dst, off_t src, off_t len)
+{
+    off_t page = (off_t)sysconf(_SC_PAGESIZE);
+    off_t lo, hi, done, n, at, mark;
+    char *map;
+
+    if (len == 0 || dst == src)
+        return 0;
+
+    /* mmap() wants a page-aligned offset */
+    lo = MU_MIN(dst, src) & ~(page - 1);
+    hi = (dst > src ? dst : src) + len;
+
+    map = mmap(NULL, (size_t)(hi - lo), PROT_READ | PROT_WRITE, MAP_SHARED, fd, lo);
+    if (map == MAP_FAILED)
+        return -errno;
+
+    (void)madvise(map, (size_t)(hi - lo), MADV_SEQUENTIAL);
+
+    for (done = 0; done < len; done += n) {
+        n = MU_MIN(len - done, (off_t)FED_MAP_WINDOW);
+
+        if (dst < src) {
+            at = done;
+            memmove(map + (dst - lo) + at, map + (src - lo) + at, (size_t)n);
+
+            /* everything below the bytes written so far is final */
+            mark = (dst + at + n - lo) & ~(page - 1);
+            (void)madvise(map, (size_t)mark, MADV_DONTNEED);
+        } else {
+            at = len - done - n;
+            memmove(map + (dst - lo) + at, map + (src - lo) + at, (size_t)n);
+
+            /* and when moving up, everything from them on */
+            mark = (dst + at - lo + page - 1) & ~(page - 1);
+            if (mark < hi - lo)
+                (void)madvise(map + mark, (size_t)(hi - lo - mark), MADV_DONTNEED);
+        }
+    }
+
+    if (munmap(map, (size_t)(hi - lo)) == -1)
+        return -errno;
+
+    return 0;
+}
+
+/*
+ * Move the len bytes at src to dst within fd with the selected engine.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+move_range(int fd, off_t dst, off_t src, off_t len)
+{
+    /* an empty edit; don't rewrite the tail onto itself */
+    if (len == 0 || dst == src)
+        return 0;
+
+    if (engine == ENGINE_MMAP)
+        return map_move(fd, dst, src, len);
+
+    if (jobs > 1 && len > (off_t)FED_BUF_SIZE)
+        return pmove(fd, dst, src, len, jobs);
+
+    if (dst < src)
+        return shift_down(fd, dst, src, len);
+
+    return shift_up(fd, dst, src, len);
+}
+
+/*
+ * On filesystems that can move extents (ext4 and XFS), bytes can be removed
+ * from or inserted into the middle of a file by remapping the blocks after
+ * them, in time that doesn't depend on how many there are.  The tail can
+ * only move by whole blocks, so the length must be a multiple of the block
+ * size; the offset needn't be, since the few bytes between it and the block
+ * boundary below it can be copied out of the way by hand.
+ */
+
+/*
+ * Try to remove [start, end) from fd, which is size bytes long, with
+ * FALLOC_FL_COLLAPSE_RANGE.
+ *
+ * Return 1 if the range was removed, 0 if it couldn't be this way (and the
+ * bytes outside the range are unchanged), or a negative errno value.
+ */
+static int
+collapse_range(int fd, off_t start, off_t end, off_t size)
+{
+    struct stat st;
+    off_t len = end - start;
+    off_t base;
+    int ret;
+
+    if (fstat(fd, &st) == -1)
+        return -errno;
+
+    /* the collapsed range can't reach EOF; that's a truncate anyway */
+    if (len == 0 || len % st.st_blksize != 0 || end >= size)
+        return 0;
+
+    /*
+     * Collapse [base, base + len) instead, after moving the bytes in
+     * [base, start), which must stay, to where the collapse will bring them
+     * back down to: the end of the doomed range.
+     */
+    base = start - start % st.st_blksize;
+    if (base < start) {
+        ret = move_range(fd, base + len, base, start - base);
+        if (ret != 0)
+            return ret;
+    }
+
+    if (fallocate(fd, FALLOC_FL_COLLAPSE_RANGE, base, len) == -1)
+        return 0;
+
+    return 1;
+}
+
+/*
+ * Try to open a gap of len bytes at start in fd, which is size bytes long,
+ * with FALLOC_FL_INSERT_RANGE.  The gap holds garbage.
+ *
+ * Return 1 if the gap was made, 0 if it couldn't be this way (and the file
+ * is unchanged), or a negative errno value.
+ */
+static int
+insert_range(int fd, off_t start, off_t len, off_t size)
+{
+    struct stat st;
+    off_t base;
+    int ret;
+
+    if (fstat(fd, &st) == -1)
+        return -errno;
+
+    /* nor can the inserted range start at EOF; that's an extend */
+    if (len == 0 || len % st.st_blksize != 0 || start >= size)
+        return 0;
+
+    /* open it at the block boundary, then move [base, start) back down in front of it */
+    base = start - start % st.st_blksize;
+    if (fallocate(fd, FALLOC_FL_INSERT_RANGE, base, len) == -1)
+        return 0;
+
+    if (base < start) {
+        ret = move_range(fd, base, base + len, start - base);
+        if (ret != 0)
+            return ret;
+    }
+
+    return 1;
+}
+
 /*
  * The remove method corresponding to -r or --remove
  * output: returns 0 on success, -1 on failure
@@ -146,109 +635,692 @@ static int
 fremove(const char *path, long start, long end, long size, int state) 
 {
     int ret = 0;
-    int rfd, wfd;
-    off_t roff, woff;
-    char buf[1] = {0};
-    long left = size - end;
-    size_t want = 0;
-    ssize_t n = 0;
+    int fd;
 
-    rfd = open(path, O_RDONLY);
-    if (rfd == -1) {
-        ret = -1;
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
         mu_stderr_errno(errno, "%s", path);
-        goto out;
+        return -1;
     }
 
-    wfd = open(path, O_WRONLY);
-    if (wfd == -1) {
+    /*
+     * CASE 1: Removing the head (start = 0) or center
+     * CASE 2: Removing the tail (end = FILE_SIZE) or entirety
+     */
+    switch(state) {
+    case 1:
+        ret = collapse_range(fd, start, end, size);
+        if (ret == 0)
+            ret = move_range(fd, start, end, size - end);
+        if (ret < 0) {
+            mu_stderr_errno(-ret, "error shifting \"%s\"", path);
+            ret = -1;
+            break;
+        }
+        /* fall through */
+    case 2:
+        ret = 0;
+        if (ftruncate(fd, state == 1 ? size - (end - start) : start) == -1) {
+            mu_stderr_errno(errno, "error truncating \"%s\"", path);
+            ret = -1;
+        }
+        break;
+    default:
         ret = -1;
+        break;
+    }
+
+    close(fd);
+    return ret;
+}
+
+/*
+ * The keep method corresponding to -k or --keep
+ * output: returns 0 on success, -1 on failure
+ */
+static int
+fkeep(const char *path, long start, long end, long size) 
+{
+    int ret = 0;
+    int fd;
+
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
         mu_stderr_errno(errno, "%s", path);
-        goto out;
+        return -1;
     }
 
-    roff = lseek(rfd, end, SEEK_SET);
-    if (roff == -1) {
-        ret = -1;
-        mu_stderr_errno(errno, "lseek");
-        goto out;
+    /*
+     * Drop the tail first, so the head has less to move past it.  Keeping
+     * the head is only that.
+     */
+    if (end < size && ftruncate(fd, end) == -1) {
+        mu_stderr_errno(errno, "error truncating \"%s\"", path);
+        close(fd);
+        return -1;
     }
 
-    woff = lseek(wfd, start, SEEK_SET);
-    if (woff == -1) {
+    if (start > 0) {
+        /* [start, end) straight down to 0, each byte once */
+        ret = collapse_range(fd, 0, start, end);
+        if (ret == 0)
+            ret = move_range(fd, 0, start, end - start);
+        if (ret < 0) {
+            mu_stderr_errno(-ret, "error shifting \"%s\"", path);
+            close(fd);
+            return -1;
+        }
+
+        ret = 0;
+        if (ftruncate(fd, end - start) == -1) {
+            mu_stderr_errno(errno, "error truncating \"%s\"", path);
+            ret = -1;
+        }
+    }
+
+    close(fd);
+    return ret;
+}
+
+/*
+ * The expunge method corresponding to -x or --expunge
+ * output: returns 0 on success, -1 on failure
+ */
+static int
+fexpunge(const char *path, long start, long end)
+{
+    int ret = 0;
+    int fd;
+    char *buf;
+    off_t off, n;
+
+    fd = open(path, O_WRONLY);
+    if (fd == -1) {
+        mu_stderr_errno(errno, "%s", path);
+        return -1;
+    }
+
+    buf = buf_alloc();
+    memset(buf, '*', FED_BUF_SIZE);
+
+    for (off = start; off < end; off += n) {
+        n = MU_MIN(end - off, (off_t)FED_BUF_SIZE);
+        ret = mu_pwrite_n(fd, buf, (size_t)n, off, NULL);
+        if (ret != 0) {
+            mu_stderr_errno(-ret, "error writing \"%s\"", path);
+            ret = -1;
+            break;
+        }
+    }
+
+    free(buf);
+    close(fd);
+    return ret;
+}
+
+/*
+ * The insert method corresponding to -i or --insert
+ * output: returns 0 on success, -1 on failure
+ */
+static int
+finsert(const char *path, long start, const char *str, long size)
+{
+    int ret = 0;
+    int fd;
+    off_t len = (off_t)strlen(str);
+
+    if (len == 0)
+        return 0;
+
+    fd = open(path, O_RDWR);
+    if (fd == -1) {
+        mu_stderr_errno(errno, "%s", path);
+        return -1;
+    }
+
+    ret = insert_range(fd, start, len, size);
+    if (ret < 0) {
+        mu_stderr_errno(-ret, "error shifting \"%s\"", path);
+        close(fd);
+        return -1;
+    }
+
+    if (ret == 0) {
+        if (ftruncate(fd, size + len) == -1) {
+            mu_stderr_errno(errno, "error extending \"%s\"", path);
+            close(fd);
+            return -1;
+        }
+
+        ret = move_range(fd, start + len, start, size - start);
+        if (ret != 0) {
+            mu_stderr_errno(-ret, "error shifting \"%s\"", path);
+            close(fd);
+            return -1;
+        }
+    }
+
+    ret = mu_pwrite_n(fd, str, (size_t)len, start, NULL);
+    if (ret != 0) {
+        mu_stderr_errno(-ret, "error writing \"%s\"", path);
         ret = -1;
-        mu_stderr_errno(errno, "lseek");
-        goto out;
     }
-    
-    /*
-     * CASE 1: Removing the head (start = 0) or center
-     * CASE 2: Removing the tail (end = FILE_SIZE) or entirety
-     */
-    switch(state) {
-    case 1:
-        want = MU_MIN(sizeof(buf), (size_t)left);
-        while (left) {
-            n = read(rfd, buf, want);
-            if (n == -1) {
-                ret = -1;
-                mu_stderr_errno(errno, "error reading %zu bytes from \"%s\"", want, path);
-                goto out;
-            }
 
-            if (n == 0)
+    close(fd);
+    return ret;
+}
+
+/*
+ * Copy len bytes at off in in to dst in out, in the kernel if it can.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+copy_range(int in, off_t off, int out, off_t dst, off_t len)
+{
+    ssize_t n;
+    char *buf;
+    size_t want, got;
+    int ret = 0;
+
+    while (len > 0) {
+        n = copy_file_range(in, &off, out, &dst, (size_t)len, 0);
+        if (n == -1) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)
                 break;
+            return -errno;
+        }
+        if (n == 0)
+            return -EIO;    /* the file shrank under us */
+
+        len -= n;
+    }
 
-            ret = mu_write_n(wfd, buf, (size_t)n, NULL);
+    if (len == 0)
+        return 0;
 
-            if (ret != 0) {
-                mu_stderr_errno(-ret, "error writing to stdout");
-                ret = -1;
-                goto out;
+    buf = buf_alloc();
+
+    while (len > 0) {
+        want = (size_t)MU_MIN(len, (off_t)FED_BUF_SIZE);
+        ret = mu_pread_n(in, buf, want, off, &got);
+        if (ret != 0)
+            break;
+        if (got != want) {
+            ret = -EIO;
+            break;
+        }
+
+        ret = mu_pwrite_n(out, buf, got, dst, NULL);
+        if (ret != 0)
+            break;
+
+        off += (off_t)got;
+        dst += (off_t)got;
+        len -= (off_t)got;
+    }
+
+    free(buf);
+    return ret;
+}
+
+/*
+ * Put len bytes at off in in at dst in out.  If the two offsets are the same
+ * distance from a block boundary, the whole blocks between them are shared
+ * with FICLONERANGE instead of copied, where the filesystem can (Btrfs, XFS),
+ * and only the ends are copied.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+put_file(int in, off_t off, int out, off_t dst, off_t len, off_t blk)
+{
+    struct file_clone_range fcr;
+    off_t head, body;
+    int ret;
+
+    if ((off - dst) % blk == 0 && len >= blk) {
+        head = (blk - off % blk) % blk;
+        body = (len - head) / blk * blk;
+
+        fcr.src_fd = in;
+        fcr.src_offset = (__u64)(off + head);
+        fcr.src_length = (__u64)body;
+        fcr.dest_offset = (__u64)(dst + head);
+
+        if (body > 0 && ioctl(out, FICLONERANGE, &fcr) == 0) {
+            ret = copy_range(in, off, out, dst, head);
+            if (ret != 0)
+                return ret;
+
+            head += body;
+            return copy_range(in, off + head, out, dst + head, len - head);
+        }
+    }
+
+    return copy_range(in, off, out, dst, len);
+}
+
+/*
+ * Write the pieces one after another into a temporary file next to path,
+ * which is open as fd, and rename it over path.  The temporary file gets
+ * path's permissions and, if we may, its owner, and is on disk before the
+ * rename, so after a crash path is either the old file or the new one.
+ *
+ * output: returns 0 on success, -1 on failure
+ */
+static int
+write_pieces(const char *path, int fd, const struct piece *pieces, size_t npieces)
+{
+    struct stat st;
+    char *tmp, *buf = NULL;
+    size_t len, i;
+    off_t dst = 0, off, n;
+    int out, ret = 0;
+
+    if (fstat(fd, &st) == -1) {
+        mu_stderr_errno(errno, "%s", path);
+        return -1;
+    }
+
+    len = strlen(path);
+    tmp = malloc(len + sizeof(".XXXXXX"));
+    if (tmp == NULL)
+        mu_die("out of memory");
+    memcpy(tmp, path, len);
+    memcpy(tmp + len, ".XXXXXX", sizeof(".XXXXXX"));
+
+    out = mkstemp(tmp);
+    if (out == -1) {
+        mu_stderr_errno(errno, "can't create a temporary file for \"%s\"", path);
+        free(tmp);
+        return -1;
+    }
+
+    (void)fchmod(out, st.st_mode & 07777);
+    (void)fchown(out, st.st_uid, st.st_gid);
+
+    for (i = 0; i < npieces && ret == 0; i++) {
+        switch (pieces[i].kind) {
+        case PIECE_FILE:
+            ret = put_file(fd, pieces[i].off, out, dst, pieces[i].len, st.st_blksize);
+            break;
+        case PIECE_DATA:
+            ret = mu_pwrite_n(out, pieces[i].data, (size_t)pieces[i].len, dst, NULL);
+            break;
+        case PIECE_FILL:
+            if (buf == NULL)
+                buf = buf_alloc();
+            memset(buf, pieces[i].fill, FED_BUF_SIZE);
+            for (off = 0; off < pieces[i].len && ret == 0; off += n) {
+                n = MU_MIN(pieces[i].len - off, (off_t)FED_BUF_SIZE);
+                ret = mu_pwrite_n(out, buf, (size_t)n, dst + off, NULL);
             }
-            
-            left -= n;
-            want = MU_MIN((size_t)left, sizeof(buf));
+            break;
         }
-        truncate(path, (size-(end-start)));
-        break;
-    case 2:
-        truncate(path, start);         
-        goto out;
-    default:
+
+        dst += pieces[i].len;
+    }
+
+    if (ret == 0 && fsync(out) == -1)
+        ret = -errno;
+    if (close(out) == -1 && ret == 0)
+        ret = -errno;
+    if (ret == 0 && rename(tmp, path) == -1)
+        ret = -errno;
+
+    if (ret != 0) {
+        mu_stderr_errno(-ret, "error writing \"%s\"", path);
+        unlink(tmp);
         ret = -1;
+    }
+
+    free(buf);
+    free(tmp);
+    return ret;
+}
+
+/*
+ * The -a or --atomic variant of remove, keep, expunge and insert: the same
+ * edit, made by describing the new file as pieces of the old one.
+ * output: returns 0 on success, -1 on failure
+ */
+static int
+fatomic(const char *path, unsigned int cmd, long start, long end,
+        const char *str, long size)
+{
+    struct piece pieces[3];
+    size_t n = 0;
+    int ret;
+    int fd;
+
+    memset(pieces, 0, sizeof(pieces));
+
+    switch (cmd) {
+    case CMD_REMOVE:
+        pieces[n++] = (struct piece){.kind = PIECE_FILE, .off = 0, .len = start};
+        pieces[n++] = (struct piece){.kind = PIECE_FILE, .off = end, .len = size - end};
+        break;
+    case CMD_KEEP:
+        pieces[n++] = (struct piece){.kind = PIECE_FILE, .off = start, .len = end - start};
         break;
+    case CMD_EXPUNGE:
+        pieces[n++] = (struct piece){.kind = PIECE_FILE, .off = 0, .len = start};
+        pieces[n++] = (struct piece){.kind = PIECE_FILL, .len = end - start, .fill = '*'};
+        pieces[n++] = (struct piece){.kind = PIECE_FILE, .off = end, .len = size - end};
+        break;
+    case CMD_INSERT:
+        pieces[n++] = (struct piece){.kind = PIECE_FILE, .off = 0, .len = start};
+        pieces[n++] = (struct piece){.kind = PIECE_DATA, .len = (off_t)strlen(str), .data = str};
+        pieces[n++] = (struct piece){.kind = PIECE_FILE, .off = start, .len = size - start};
+        break;
+    default:
+        mu_die("unexpected cmd: %u", cmd);
     }
 
-out:
-    if (rfd != -1)
-        close(rfd);
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        mu_stderr_errno(errno, "%s", path);
+        return -1;
+    }
 
-    if (wfd != -1)
-        close(wfd);
+    ret = write_pieces(path, fd, pieces, n);
 
+    close(fd);
     return ret;
 }
 
+static void *
+xreallocarray(void *p, size_t n, size_t size)
+{
+    p = reallocarray(p, n, size);
+    if (p == NULL)
+        mu_die("out of memory");
+
+    return p;
+}
+
 /*
- * The print method corresponding to -k or --keep
+ * Parse a line of the -f script SCRIPT into e.  Return true if it holds an
+ * edit, false if it's blank or a comment; die if it's malformed.
+ */
+static bool
+parse_edit(const char *script, size_t lineno, char *line, long size, struct edit *e)
+{
+    char *op, *arg, *str = NULL;
+    long n;
+    int ret;
+
+    line[strcspn(line, "\n")] = '\0';
+    while (isspace((unsigned char)*line))
+        line++;
+    if (*line == '\0' || *line == '#')
+        return false;
+
+    memset(e, 0, sizeof(*e));
+    e->line = lineno;
+
+    op = strsep(&line, " \t");
+    if (!strcmp(op, "remove") || !strcmp(op, "r"))
+        e->cmd = CMD_REMOVE;
+    else if (!strcmp(op, "keep") || !strcmp(op, "k"))
+        e->cmd = CMD_KEEP;
+    else if (!strcmp(op, "expunge") || !strcmp(op, "x"))
+        e->cmd = CMD_EXPUNGE;
+    else if (!strcmp(op, "insert") || !strcmp(op, "i"))
+        e->cmd = CMD_INSERT;
+    else
+        mu_die("%s:%zu: unknown operation \"%s\"", script, lineno, op);
+
+    arg = line != NULL ? strsep(&line, " \t") : NULL;
+    if (arg == NULL)
+        mu_die("%s:%zu: missing START", script, lineno);
+    ret = mu_str_to_long(arg, 10, &n);
+    if (ret != 0 || n < 0 || n > size)
+        mu_die("%s:%zu: invalid START \"%s\"", script, lineno, arg);
+    e->start = n;
+
+    /* everything after the space is the string, spaces and all */
+    if (e->cmd == CMD_INSERT) {
+        str = line != NULL ? line : "";
+        e->str = strdup(str);
+        if (e->str == NULL)
+            mu_die("out of memory");
+        e->end = e->start;
+        return true;
+    }
+
+    arg = line != NULL ? strsep(&line, " \t") : NULL;
+    if (arg == NULL)
+        mu_die("%s:%zu: missing END", script, lineno);
+    ret = mu_str_to_long(arg, 10, &n);
+    if (ret != 0 || n < e->start || n > size)
+        mu_die("%s:%zu: invalid END \"%s\"", script, lineno, arg);
+    e->end = n;
+
+    if (line != NULL && line[strspn(line, " \t")] != '\0')
+        mu_die("%s:%zu: trailing garbage \"%s\"", script, lineno, line);
+
+    return true;
+}
+
+static int
+cmp_range(const void *a, const void *b)
+{
+    const struct range *x = a, *y = b;
+
+    return (x->start > y->start) - (x->start < y->start);
+}
+
+/* Sort the ranges and merge the ones that overlap or touch; return how many are left. */
+static size_t
+coalesce(struct range *r, size_t n)
+{
+    size_t i, m = 0;
+
+    if (n == 0)
+        return 0;
+
+    qsort(r, n, sizeof(*r), cmp_range);
+
+    for (i = 1; i < n; i++) {
+        if (r[i].start <= r[m].end) {
+            if (r[i].end > r[m].end)
+                r[m].end = r[i].end;
+        } else {
+            r[++m] = r[i];
+        }
+    }
+
+    return m + 1;
+}
+
+/* Insertions go by offset, then in script order. */
+static int
+cmp_insert(const void *a, const void *b)
+{
+    const struct edit *x = a, *y = b;
+
+    if (x->start != y->start)
+        return (x->start > y->start) - (x->start < y->start);
+
+    return (x->line > y->line) - (x->line < y->line);
+}
+
+static int
+cmp_off(const void *a, const void *b)
+{
+    off_t x = *(const off_t *)a, y = *(const off_t *)b;
+
+    return (x > y) - (x < y);
+}
+
+/* Append p to the list, growing the last piece instead if p just continues it. */
+static void
+add_piece(struct piece **pieces, size_t *n, size_t *cap, struct piece p)
+{
+    struct piece *last = *n > 0 ? &(*pieces)[*n - 1] : NULL;
+
+    if (p.len == 0)
+        return;
+
+    if (last != NULL && last->kind == p.kind &&
+            ((p.kind == PIECE_FILE && last->off + last->len == p.off) ||
+             (p.kind == PIECE_FILL && last->fill == p.fill))) {
+        last->len += p.len;
+        return;
+    }
+
+    if (*n == *cap) {
+        *cap = *cap ? *cap * 2 : 16;
+        *pieces = xreallocarray(*pieces, *cap, sizeof(**pieces));
+    }
+    (*pieces)[(*n)++] = p;
+}
+
+/*
+ * The script method corresponding to -f or --script.  All of the edits are
+ * in terms of the original file, so rather than apply them one after
+ * another (each rewriting the rest of the file), turn them into the list
+ * of pieces the new file is made of and write that once.
+ *
  * output: returns 0 on success, -1 on failure
  */
 static int
-fkeep(const char *path, long start, long end, long size) 
+fscript(const char *path, const char *script, long size)
 {
-    int ret = 0;
-    if(start == 0) { //keep head
-        fremove(path, end, size, size, 2);
+    FILE *fp;
+    char *line = NULL;
+    size_t linecap = 0, lineno = 0;
+    struct edit e, *inserts = NULL;
+    struct range *drops = NULL, *stars = NULL, *keeps = NULL;
+    size_t ninserts = 0, ndrops = 0, nstars = 0, nkeeps = 0;
+    struct piece *pieces = NULL;
+    size_t npieces = 0, piececap = 0;
+    off_t *breaks, p, q;
+    size_t nbreaks = 0, i, k, di = 0, si = 0, ii = 0;
+    bool any_keep = false;
+    int ret, fd;
+
+    fp = fopen(script, "r");
+    if (fp == NULL) {
+        mu_stderr_errno(errno, "%s", script);
+        return -1;
+    }
+
+    while (getline(&line, &linecap, fp) != -1) {
+        if (!parse_edit(script, ++lineno, line, size, &e))
+            continue;
+
+        switch (e.cmd) {
+        case CMD_REMOVE:
+            drops = xreallocarray(drops, ndrops + 1, sizeof(*drops));
+            drops[ndrops++] = (struct range){e.start, e.end};
+            break;
+        case CMD_KEEP:
+            keeps = xreallocarray(keeps, nkeeps + 1, sizeof(*keeps));
+            keeps[nkeeps++] = (struct range){e.start, e.end};
+            any_keep = true;
+            break;
+        case CMD_EXPUNGE:
+            stars = xreallocarray(stars, nstars + 1, sizeof(*stars));
+            stars[nstars++] = (struct range){e.start, e.end};
+            break;
+        case CMD_INSERT:
+            inserts = xreallocarray(inserts, ninserts + 1, sizeof(*inserts));
+            inserts[ninserts++] = e;
+            break;
+        }
+    }
+
+    if (ferror(fp)) {
+        mu_stderr_errno(errno, "error reading \"%s\"", script);
+        fclose(fp);
+        free(line);
+        return -1;
+    }
+    fclose(fp);
+    free(line);
+
+    /* everything outside the kept ranges goes too */
+    if (any_keep) {
+        nkeeps = coalesce(keeps, nkeeps);
+        drops = xreallocarray(drops, ndrops + nkeeps + 1, sizeof(*drops));
+        for (i = 0, p = 0; i < nkeeps; p = keeps[i++].end)
+            drops[ndrops++] = (struct range){p, keeps[i].start};
+        drops[ndrops++] = (struct range){p, size};
+    }
+
+    ndrops = coalesce(drops, ndrops);
+    nstars = coalesce(stars, nstars);
+    qsort(inserts, ninserts, sizeof(*inserts), cmp_insert);
+
+    /* the offsets at which what happens to the bytes can change */
+    breaks = xreallocarray(NULL, 2 * (ndrops + nstars) + ninserts + 1, sizeof(*breaks));
+    for (i = 0; i < ndrops; i++) {
+        breaks[nbreaks++] = drops[i].start;
+        breaks[nbreaks++] = drops[i].end;
     }
-    else if(end == size) { //keep tail
-        fremove(path, 0, start, size, 1);
+    for (i = 0; i < nstars; i++) {
+        breaks[nbreaks++] = stars[i].start;
+        breaks[nbreaks++] = stars[i].end;
     }
-    else { //keep center
-        fremove(path, end, size, size, 2);
-        fremove(path, 0, start, (size-(size-end)), 1);
+    for (i = 0; i < ninserts; i++)
+        breaks[nbreaks++] = inserts[i].start;
+    breaks[nbreaks++] = size;
+    qsort(breaks, nbreaks, sizeof(*breaks), cmp_off);
+
+    for (i = 0, p = 0; p <= size; p = q) {
+        /* the strings inserted here come before the byte here */
+        for (; ii < ninserts && inserts[ii].start == p; ii++)
+            add_piece(&pieces, &npieces, &piececap, (struct piece){
+                    .kind = PIECE_DATA, .len = (off_t)strlen(inserts[ii].str),
+                    .data = inserts[ii].str});
+
+        if (p == size)
+            break;
+
+        while (breaks[i] <= p)
+            i++;
+        q = breaks[i];
+
+        for (; di < ndrops && drops[di].end <= p; di++)
+            ;
+        for (; si < nstars && stars[si].end <= p; si++)
+            ;
+
+        if (di < ndrops && drops[di].start <= p)
+            continue;
+
+        if (si < nstars && stars[si].start <= p)
+            add_piece(&pieces, &npieces, &piececap, (struct piece){
+                    .kind = PIECE_FILL, .len = q - p, .fill = '*'});
+        else
+            add_piece(&pieces, &npieces, &piececap, (struct piece){
+                    .kind = PIECE_FILE, .off = p, .len = q - p});
     }
 
+    fd = open(path, O_RDONLY);
+    if (fd == -1) {
+        mu_stderr_errno(errno, "%s", path);
+        ret = -1;
+    } else {
+        ret = write_pieces(path, fd, pieces, npieces);
+        close(fd);
+    }
+
+    for (k = 0; k < ninserts; k++)
+        free(inserts[k].str);
+    free(inserts);
+    free(drops);
+    free(stars);
+    free(keeps);
+    free(breaks);
+    free(pieces);
     return ret;
 }
 
@@ -260,7 +1332,7 @@ main(int argc,char *argv[])
      * An option that takes a required argument is followed by a ':'.
      * The leading ':' suppresses getopt_long's normal error handling.
      */
-    const char *short_opts = ":hprkxi:s:e:";
+    const char *short_opts = ":hprkxi:s:e:f:aj:m";
     struct option long_opts[] = {
         {"help", no_argument, NULL, 'h'},
         {"print", no_argument, NULL, 'p'},
@@ -270,14 +1342,21 @@ main(int argc,char *argv[])
         {"insert", required_argument, NULL, 'i'},        
         {"start", required_argument, NULL, 's'},
         {"end", required_argument, NULL, 'e'},
+        {"script", required_argument, NULL, 'f'},
+        {"atomic", no_argument, NULL, 'a'},
+        {"jobs", required_argument, NULL, 'j'},
+        {"mmap", no_argument, NULL, 'm'},
         {NULL, 0, NULL, 0}
     };
 
     unsigned int cmd = 0;
     long start = -1, end = -1; //NULL values
-    int size = -1, ret = 0;
+    long size = -1;
+    const char *str = NULL;
+    const char *script = NULL;
+    int ret = 0;
     int EXIT_STATUS = 0;
-    bool negative_ticked = false;
+    bool atomic = false;
 
     long FILE_SIZE = (long)file_size(argv[argc-1]);
 
@@ -292,6 +1371,9 @@ main(int argc,char *argv[])
         case 'h':
             usage(0);
             return 0;
+        case 'p':
+            cmd |= CMD_PRINT;
+            break;
         case 'r':
             cmd |= CMD_REMOVE;
             break;
@@ -303,24 +1385,39 @@ main(int argc,char *argv[])
             break;
         case 'i':
             cmd |= CMD_INSERT;
+            str = optarg;
+            break;
+        case 'f':
+            script = optarg;
+            break;
+        case 'a':
+            atomic = true;
+            break;
+        case 'j':
+            ret = mu_str_to_int(optarg, 10, &jobs);
+            if(ret != 0 || jobs < 1)
+                mu_die("invalid value for --jobs: \"%s\"", optarg);
+            break;
+        case 'm':
+            engine = ENGINE_MMAP;
             break;
         case 's':
-            ret = mu_str_to_int(optarg, 10, &size);
+            ret = mu_str_to_long(optarg, 10, &size);
             if(ret != 0)
                 die_errno(-ret, "invalid value for --start: \"%s\"", optarg);
 
-            if(size < 0 || size > FILE_SIZE) 
-                negative_ticked = true;
+            if(size < 0 || size > FILE_SIZE)
+                mu_die("--start must be in the range [0, %ld]: \"%s\"", FILE_SIZE, optarg);
 
             start = size;
             break;
         case 'e':
-            ret = mu_str_to_int(optarg, 10, &size);
+            ret = mu_str_to_long(optarg, 10, &size);
             if(ret != 0)
                 die_errno(-ret, "invalid value for --end: \"%s\"", optarg);
 
-            if(size < 0 || size > FILE_SIZE) 
-                negative_ticked = true;
+            if(size < 0 || size > FILE_SIZE)
+                mu_die("--end must be in the range [0, %ld]: \"%s\"", FILE_SIZE, optarg);
 
             end = size;
             break;
@@ -335,25 +1432,29 @@ main(int argc,char *argv[])
         }
     }
 
-    /*
-     *  ERROR CHECKING FOR START AND END
-     */
-    if(negative_ticked) {
-        if(start < 0)
-            die_errno(-ret, "invalid negative value for --start: \"%ld\"", start);
-        else
-            die_errno(-ret, "invalid negative value for --end: \"%ld\"", end);
+    if (script != NULL) {
+        if (cmd != CMD_PRINT || start != -1 || end != -1)
+            mu_die("-f takes its operations and offsets from SCRIPT");
+
+        EXIT_STATUS = fscript(argv[argc-1], script, FILE_SIZE);
+        exit(EXIT_STATUS);
     }
 
-    if(start < 0 || start >= FILE_SIZE)
+    /* START = FILE_SIZE is an empty range at the end; inserting there appends */
+    if(start < 0)
         start = 0;
     
     if(end < 0 || end > FILE_SIZE)
         end = FILE_SIZE;
 
     if(start > end) {
-        start = 0;
-        end = 0;
+        mu_stderr("--start (%ld) is past --end (%ld)", start, end);
+        usage(1);
+    }
+
+    if (atomic && cmd != CMD_PRINT) {
+        EXIT_STATUS = fatomic(argv[argc-1], cmd, start, end, str, FILE_SIZE);
+        exit(EXIT_STATUS);
     }
 
     switch (cmd) {
@@ -375,10 +1476,10 @@ main(int argc,char *argv[])
         EXIT_STATUS = fkeep(argv[argc-1], start, end, FILE_SIZE);
         break;
     case CMD_EXPUNGE:
-        /* TODO: call expunge function */
+        EXIT_STATUS = fexpunge(argv[argc-1], start, end);
         break;
     case CMD_INSERT:
-        /* TODO: call insert function */
+        EXIT_STATUS = finsert(argv[argc-1], start, str, FILE_SIZE);
         break;
     default:
         mu_die("unexpected cmd: %u", cmd);
@@ -0,0 +1,176 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mu.h"
+#include "pmove.h"
+
+#define PMOVE_CHUNK     (1U << 20)  /* bytes per pread/pwrite pair */
+#define PMOVE_ALIGN     4096
+
+struct pmove {
+    int fd;
+    off_t dst;
+    off_t src;
+    off_t len;
+    bool up;
+    uint64_t lag;           /* a chunk's write waits for the reads up to this many chunks back */
+    uint64_t nchunks;
+
+    pthread_mutex_t lock;
+    pthread_cond_t read_done;
+    uint64_t next;          /* the next chunk to hand out, in move order */
+    uint64_t rlo;           /* every chunk before this one has been read */
+    bool *rdone;
+    int err;
+};
+
+static void
+chunk_at(const struct pmove *p, uint64_t c, off_t *rel, size_t *n)
+{
+    off_t end;
+
+    if (!p->up) {
+        *rel = (off_t)(c * PMOVE_CHUNK);
+        *n = (size_t)MU_MIN(p->len - *rel, (off_t)PMOVE_CHUNK);
+    } else {
+        end = p->len - (off_t)(c * PMOVE_CHUNK);
+        *n = (size_t)MU_MIN(end, (off_t)PMOVE_CHUNK);
+        *rel = end - (off_t)*n;
+    }
+}
+
+/* Record the first error, and wake anyone waiting so they can give up. */
+static void
+pmove_fail(struct pmove *p, int err)
+{
+    pthread_mutex_lock(&p->lock);
+    if (p->err == 0)
+        p->err = err;
+    pthread_cond_broadcast(&p->read_done);
+    pthread_mutex_unlock(&p->lock);
+}
+
+static void *
+pmove_worker(void *arg /* pmove */)
+{
+    struct pmove *p = arg;
+    char *buf;
+    uint64_t c;
+    size_t n, got;
+    off_t rel;
+    int ret;
+
+    ret = posix_memalign((void **)&buf, PMOVE_ALIGN, PMOVE_CHUNK);
+    if (ret != 0) {
+        pmove_fail(p, -ret);
+        return NULL;
+    }
+
+    for (;;) {
+        pthread_mutex_lock(&p->lock);
+        if (p->err != 0 || p->next == p->nchunks) {
+            pthread_mutex_unlock(&p->lock);
+            break;
+        }
+        c = p->next++;
+        pthread_mutex_unlock(&p->lock);
+
+        chunk_at(p, c, &rel, &n);
+
+        /* no write that's allowed to happen yet touches our source */
+        ret = mu_pread_n(p->fd, buf, n, p->src + rel, &got);
+        if (ret == 0 && got != n)
+            ret = -EIO;     /* the file shrank under us */
+        if (ret != 0) {
+            pmove_fail(p, ret);
+            break;
+        }
+
+        pthread_mutex_lock(&p->lock);
+        p->rdone[c] = true;
+        while (p->rlo < p->nchunks && p->rdone[p->rlo])
+            p->rlo++;
+        pthread_cond_broadcast(&p->read_done);
+
+        /* the chunks whose source we're about to overwrite must be read first */
+        while (p->err == 0 && c >= p->lag && p->rlo <= c - p->lag)
+            pthread_cond_wait(&p->read_done, &p->lock);
+        ret = p->err;
+        pthread_mutex_unlock(&p->lock);
+
+        if (ret != 0)
+            break;
+
+        ret = mu_pwrite_n(p->fd, buf, n, p->dst + rel, NULL);
+        if (ret != 0) {
+            pmove_fail(p, ret);
+            break;
+        }
+    }
+
+    free(buf);
+    return NULL;
+}
+
+int
+pmove(int fd, off_t dst, off_t src, off_t len, int nthreads)
+{
+    struct pmove p;
+    pthread_t *threads;
+    off_t gap = dst > src ? dst - src : src - dst;
+    int i, ret;
+
+    if (len == 0 || gap == 0)
+        return 0;
+
+    memset(&p, 0, sizeof(p));
+    p.fd = fd;
+    p.dst = dst;
+    p.src = src;
+    p.len = len;
+    p.up = dst > src;
+    p.nchunks = ((uint64_t)len + PMOVE_CHUNK - 1) / PMOVE_CHUNK;
+
+    /*
+     * Chunk c writes [c*CHUNK, c*CHUNK + CHUNK) + dst, which is the source
+     * of the chunks gap/CHUNK - 1 to gap/CHUNK + 1 places back (exclusive),
+     * and of none after it.  So it must wait for the reads of every chunk
+     * up to c - max(1, floor(gap/CHUNK)); its own read comes first anyway.
+     */
+    p.lag = (uint64_t)(gap / PMOVE_CHUNK);
+    if (p.lag == 0)
+        p.lag = 1;
+
+    p.rdone = calloc(p.nchunks, sizeof(*p.rdone));
+    threads = calloc((size_t)nthreads, sizeof(*threads));
+    if (p.rdone == NULL || threads == NULL)
+        mu_die("out of memory");
+
+    pthread_mutex_init(&p.lock, NULL);
+    pthread_cond_init(&p.read_done, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+        ret = pthread_create(&threads[i], NULL, pmove_worker, &p);
+        if (ret != 0)
+            mu_die_errno(ret, "pthread_create");
+    }
+
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+
+    pthread_mutex_destroy(&p.lock);
+    pthread_cond_destroy(&p.read_done);
+    free(threads);
+    free(p.rdone);
+
+    return p.err;
+}
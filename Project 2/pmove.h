@@ -0,0 +1,23 @@
+#ifndef _PMOVE_H_
+#define _PMOVE_H_
+
+#include <sys/types.h>
+
+/*
+ * Move the len bytes at src to dst within fd with nthreads threads, each
+ * copying one chunk at a time with pread() and pwrite().
+ *
+ * The chunks are handed out front to back when dst < src and back to front
+ * when dst > src.  In that order a chunk's write can only land on the
+ * source of the chunks gap / chunk size or so before it, so each thread
+ * reads its chunk straight away but holds the write until those have been
+ * read; chunks further apart than that are copied fully in parallel.
+ *
+ * The file must already reach dst + len.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+int pmove(int fd, off_t dst, off_t src, off_t len, int nthreads);
+
+#endif /* _PMOVE_H_ */
@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# Edits at the very end of the file: START = FSIZE is an empty range for
+# every command (insert appends there), and START > FSIZE or START > END
+# is an error.
+#
+# Usage: ./test.sh [FED]
+
+FED=${1:-./fed}
+DIR=$(mktemp -d) || exit 1
+trap 'rm -rf "$DIR"' EXIT
+
+ORIG=$DIR/orig
+FILE=$DIR/file
+printf 'hello, world\n' > "$ORIG"
+FSIZE=$(wc -c < "$ORIG")
+fails=0
+
+fail()
+{
+    echo "FAIL: $*"
+    fails=$((fails + 1))
+}
+
+# check NAME EXPECTED FED-ARGS...: run fed on a fresh copy and compare
+check()
+{
+    name=$1 expected=$2
+    shift 2
+    cp "$ORIG" "$FILE"
+    if ! "$FED" "$@" "$FILE" > "$DIR/out"; then
+        fail "$name: fed exited with status $?"
+        return
+    fi
+    printf '%s' "$expected" | cmp -s - "$FILE" || fail "$name: wrong result"
+}
+
+hello=$(cat "$ORIG"; printf x)
+hello=${hello%x}
+
+check "expunge at end" "$hello" -x -s "$FSIZE"
+check "expunge at end, with END" "$hello" -x -s "$FSIZE" -e "$FSIZE"
+check "remove at end" "$hello" -r -s "$FSIZE"
+check "remove at end, with END" "$hello" -r -s "$FSIZE" -e "$FSIZE"
+check "keep at end" "" -k -s "$FSIZE"
+check "insert at end" "${hello}bye" -i bye -s "$FSIZE"
+check "atomic expunge at end" "$hello" -a -x -s "$FSIZE"
+check "atomic remove at end" "$hello" -a -r -s "$FSIZE"
+check "atomic keep at end" "" -a -k -s "$FSIZE"
+check "atomic insert at end" "${hello}bye" -a -i bye -s "$FSIZE"
+
+cp "$ORIG" "$FILE"
+"$FED" -s "$FSIZE" "$FILE" > "$DIR/out" || fail "print at end: fed exited with status $?"
+[ -s "$DIR/out" ] && fail "print at end: printed something"
+
+for cmd in -x -r -k "-i bye"; do
+    cp "$ORIG" "$FILE"
+    # shellcheck disable=SC2086
+    if "$FED" $cmd -s $((FSIZE + 1)) "$FILE" > /dev/null 2>&1; then
+        fail "$cmd past the end: accepted START > FSIZE"
+    fi
+    cmp -s "$ORIG" "$FILE" || fail "$cmd past the end: changed the file"
+done
+
+for cmd in -p -x -r -k "-i bye"; do
+    cp "$ORIG" "$FILE"
+    # shellcheck disable=SC2086
+    if "$FED" $cmd -s 5 -e 4 "$FILE" > /dev/null 2>&1; then
+        fail "$cmd with START > END: accepted it"
+    fi
+    cmp -s "$ORIG" "$FILE" || fail "$cmd with START > END: changed the file"
+done
+
+if [ $fails -ne 0 ]; then
+    echo "$fails failed"
+    exit 1
+fi
+echo "all passed"
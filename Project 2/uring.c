@@ -0,0 +1,351 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <sys/uio.h>
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <linux/io_uring.h>
+
+#include "mu.h"
+#include "uring.h"
+
+#define URING_CHUNK     (1U << 20)  /* bytes per read/write pair */
+#define URING_DEPTH     8           /* most pairs in flight */
+#define URING_ALIGN     4096        /* for O_DIRECT */
+
+/* The two halves of a pair, in the low bit of user_data. */
+#define URING_READ      0
+#define URING_WRITE     1
+
+struct ring {
+    int fd;
+
+    void *sq_map;
+    size_t sq_map_len;
+    unsigned *sq_head;
+    unsigned *sq_tail;
+    unsigned *sq_mask;
+    unsigned *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_len;
+    unsigned sq_local_tail;
+
+    void *cq_map;               /* == sq_map with IORING_FEAT_SINGLE_MMAP */
+    size_t cq_map_len;
+    unsigned *cq_head;
+    unsigned *cq_tail;
+    unsigned *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+static void
+ring_close(struct ring *r)
+{
+    if (r->sqes != NULL)
+        munmap(r->sqes, r->sqes_len);
+    if (r->cq_map != NULL && r->cq_map != r->sq_map)
+        munmap(r->cq_map, r->cq_map_len);
+    if (r->sq_map != NULL)
+        munmap(r->sq_map, r->sq_map_len);
+    close(r->fd);
+    memset(r, 0, sizeof(*r));
+}
+
+/*
+ * Set up a ring with room for entries submissions, and map its queues.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+ring_setup(struct ring *r, unsigned entries)
+{
+    struct io_uring_params p;
+    void *map;
+    int ret;
+
+    memset(r, 0, sizeof(*r));
+    memset(&p, 0, sizeof(p));
+
+    r->fd = (int)syscall(__NR_io_uring_setup, entries, &p);
+    if (r->fd == -1)
+        return -errno;
+
+    r->sq_map_len = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_map_len = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (r->cq_map_len > r->sq_map_len)
+            r->sq_map_len = r->cq_map_len;
+        r->cq_map_len = r->sq_map_len;
+    }
+
+    map = mmap(NULL, r->sq_map_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    if (map == MAP_FAILED)
+        goto fail;
+    r->sq_map = map;
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        r->cq_map = r->sq_map;
+    } else {
+        map = mmap(NULL, r->cq_map_len, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+        if (map == MAP_FAILED)
+            goto fail;
+        r->cq_map = map;
+    }
+
+    r->sqes_len = p.sq_entries * sizeof(struct io_uring_sqe);
+    map = mmap(NULL, r->sqes_len, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (map == MAP_FAILED)
+        goto fail;
+    r->sqes = map;
+
+    r->sq_head = (unsigned *)((char *)r->sq_map + p.sq_off.head);
+    r->sq_tail = (unsigned *)((char *)r->sq_map + p.sq_off.tail);
+    r->sq_mask = (unsigned *)((char *)r->sq_map + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *)((char *)r->sq_map + p.sq_off.array);
+    r->sq_local_tail = *r->sq_tail;
+
+    r->cq_head = (unsigned *)((char *)r->cq_map + p.cq_off.head);
+    r->cq_tail = (unsigned *)((char *)r->cq_map + p.cq_off.tail);
+    r->cq_mask = (unsigned *)((char *)r->cq_map + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *)((char *)r->cq_map + p.cq_off.cqes);
+
+    return 0;
+
+fail:
+    ret = -errno;
+    ring_close(r);
+    return ret;
+}
+
+/* Queue a read or write; the caller makes sure there's room. */
+static void
+ring_prep(struct ring *r, uint8_t op, int fd, void *buf, unsigned len,
+        off_t off, int buf_index, uint8_t flags, uint64_t user_data)
+{
+    unsigned idx = r->sq_local_tail & *r->sq_mask;
+    struct io_uring_sqe *sqe = &r->sqes[idx];
+
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = op;
+    sqe->flags = flags;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)(uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = (uint64_t)off;
+    sqe->buf_index = (uint16_t)(buf_index < 0 ? 0 : buf_index);
+    sqe->user_data = user_data;
+
+    r->sq_array[idx] = idx;
+    r->sq_local_tail++;
+    __atomic_store_n(r->sq_tail, r->sq_local_tail, __ATOMIC_RELEASE);
+}
+
+/*
+ * Submit everything queued and wait for at least one completion.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value.
+ */
+static int
+ring_submit_and_wait(struct ring *r)
+{
+    unsigned pending;
+    int n;
+
+    for (;;) {
+        /* the kernel moves the head past what it has consumed, even if interrupted */
+        pending = r->sq_local_tail - __atomic_load_n(r->sq_head, __ATOMIC_ACQUIRE);
+        n = (int)syscall(__NR_io_uring_enter, r->fd, pending, 1,
+                IORING_ENTER_GETEVENTS, NULL, 0);
+        if (n >= 0)
+            return 0;
+        if (errno != EINTR)
+            return -errno;
+    }
+}
+
+/* The state of one move, and the chunk that's at index c in move order. */
+struct mover {
+    off_t dst;
+    off_t src;
+    off_t len;
+    bool up;
+};
+
+static void
+chunk_at(const struct mover *m, uint64_t c, off_t *rel, unsigned *n)
+{
+    off_t end;
+
+    if (!m->up) {
+        *rel = (off_t)(c * URING_CHUNK);
+        *n = (unsigned)MU_MIN(m->len - *rel, (off_t)URING_CHUNK);
+    } else {
+        end = m->len - (off_t)(c * URING_CHUNK);
+        *n = (unsigned)MU_MIN(end, (off_t)URING_CHUNK);
+        *rel = end - *n;
+    }
+}
+
+/* Queue the read or write of chunk c into or out of buffer slot i. */
+static void
+prep_chunk(struct ring *r, const struct mover *m, int fd, const struct iovec *iov,
+        bool fixed, uint64_t c, int half, uint8_t flags)
+{
+    unsigned i = (unsigned)(c % URING_DEPTH);
+    unsigned n;
+    off_t rel;
+
+    chunk_at(m, c, &rel, &n);
+
+    if (half == URING_READ)
+        ring_prep(r, fixed ? IORING_OP_READ_FIXED : IORING_OP_READ, fd,
+                iov[i].iov_base, n, m->src + rel, fixed ? (int)i : -1,
+                flags, c << 1 | URING_READ);
+    else
+        ring_prep(r, fixed ? IORING_OP_WRITE_FIXED : IORING_OP_WRITE, fd,
+                iov[i].iov_base, n, m->dst + rel, fixed ? (int)i : -1,
+                flags, c << 1 | URING_WRITE);
+}
+
+int
+uring_move(int fd, off_t dst, off_t src, off_t len)
+{
+    struct mover m = {dst, src, len, dst > src};
+    struct ring r;
+    struct iovec iov[URING_DEPTH];
+    struct io_uring_cqe *cqe;
+    bool rdone[URING_DEPTH] = {false}, wdone[URING_DEPTH] = {false};
+    bool fixed, linked;
+    char *bufs;
+    uint64_t nchunks, c;
+    uint64_t nread = 0, nwritten = 0;   /* chunks queued */
+    uint64_t rlo = 0, wlo = 0;          /* chunks done, in move order */
+    unsigned head, tail, n, i, inflight = 0;
+    off_t gap = dst > src ? dst - src : src - dst;
+    off_t rel;
+    int ret, err = 0, flags = -1;
+
+    if (len == 0 || gap == 0)
+        return 0;
+
+    ret = ring_setup(&r, 2 * URING_DEPTH);
+    if (ret != 0)
+        return -ENOSYS;
+
+    ret = posix_memalign((void **)&bufs, URING_ALIGN, (size_t)URING_DEPTH * URING_CHUNK);
+    if (ret != 0) {
+        ring_close(&r);
+        return -ret;
+    }
+
+    for (i = 0; i < URING_DEPTH; i++) {
+        iov[i].iov_base = bufs + (size_t)i * URING_CHUNK;
+        iov[i].iov_len = URING_CHUNK;
+    }
+
+    /* pinning the buffers can fail under a small RLIMIT_MEMLOCK; plain reads and writes still work */
+    fixed = syscall(__NR_io_uring_register, r.fd, IORING_REGISTER_BUFFERS, iov, URING_DEPTH) == 0;
+
+    if (dst % URING_ALIGN == 0 && src % URING_ALIGN == 0 && len % URING_ALIGN == 0) {
+        flags = fcntl(fd, F_GETFL);
+        if (flags != -1 && fcntl(fd, F_SETFL, flags | O_DIRECT) == -1)
+            flags = -1;
+    }
+
+    /*
+     * A chunk's write never lands on the source of a chunk after it in move
+     * order, but it can land on the source of the chunks up to
+     * gap / URING_CHUNK + 1 before it, so it mustn't be queued until they've
+     * been read.  If that's further back than the whole window, each write
+     * can simply be linked to its read.  Otherwise the reads run ahead and
+     * each write is queued once every read up to its own is done.
+     */
+    linked = gap >= (off_t)URING_DEPTH * URING_CHUNK;
+    nchunks = ((uint64_t)len + URING_CHUNK - 1) / URING_CHUNK;
+
+    while (wlo < nchunks) {
+        /* a buffer is free once the write out of it is done */
+        for (; err == 0 && nread < nchunks && nread < wlo + URING_DEPTH; nread++) {
+            prep_chunk(&r, &m, fd, iov, fixed, nread, URING_READ, linked ? IOSQE_IO_LINK : 0);
+            inflight++;
+            if (linked) {
+                prep_chunk(&r, &m, fd, iov, fixed, nread, URING_WRITE, 0);
+                nwritten++;
+                inflight++;
+            }
+        }
+
+        for (; err == 0 && nwritten < rlo; nwritten++) {
+            prep_chunk(&r, &m, fd, iov, fixed, nwritten, URING_WRITE, 0);
+            inflight++;
+        }
+
+        if (inflight == 0)
+            break;
+
+        ret = ring_submit_and_wait(&r);
+        if (ret != 0) {
+            /* we can't know what's still in flight, so don't free the buffers under it */
+            err = ret;
+            break;
+        }
+
+        head = *r.cq_head;
+        tail = __atomic_load_n(r.cq_tail, __ATOMIC_ACQUIRE);
+        for (; head != tail; head++) {
+            cqe = &r.cqes[head & *r.cq_mask];
+            c = cqe->user_data >> 1;
+            chunk_at(&m, c, &rel, &n);
+            inflight--;
+
+            if (cqe->res < 0) {
+                /* the write after a failed read is cancelled; report the read */
+                if (err == 0 || err == -ECANCELED)
+                    err = cqe->res;
+            } else if ((unsigned)cqe->res != n) {
+                if (err == 0)
+                    err = -EIO;     /* the file shrank under us */
+            } else if ((cqe->user_data & 1) == URING_READ) {
+                rdone[c % URING_DEPTH] = true;
+            } else {
+                wdone[c % URING_DEPTH] = true;
+            }
+        }
+        __atomic_store_n(r.cq_head, head, __ATOMIC_RELEASE);
+
+        while (rlo < nread && rdone[rlo % URING_DEPTH]) {
+            rdone[rlo % URING_DEPTH] = false;
+            rlo++;
+        }
+        while (wlo < nwritten && wdone[wlo % URING_DEPTH]) {
+            wdone[wlo % URING_DEPTH] = false;
+            wlo++;
+        }
+
+        if (err != 0 && inflight == 0)
+            break;
+    }
+
+    if (flags != -1)
+        (void)fcntl(fd, F_SETFL, flags);
+
+    ring_close(&r);
+    if (inflight == 0)
+        free(bufs);
+
+    return err;
+}
@@ -0,0 +1,23 @@
+#ifndef _URING_H_
+#define _URING_H_
+
+#include <sys/types.h>
+
+/*
+ * Move the len bytes at src to dst within fd with io_uring, keeping several
+ * reads and writes in flight at once through a ring of registered buffers.
+ * The chunks go front to back when dst < src and back to front when
+ * dst > src, and a chunk isn't written until every chunk it could overwrite
+ * has been read; when src and dst are far enough apart for that to be a
+ * given, each write is linked to its read.  When src, dst and len are all
+ * page-aligned, fd is switched to O_DIRECT for the move.
+ *
+ * The file must already reach dst + len.
+ *
+ * On success, return 0.
+ * On failure, return a negative errno value; -ENOSYS if io_uring isn't
+ * available, in which case nothing was moved.
+ */
+int uring_move(int fd, off_t dst, off_t src, off_t len);
+
+#endif /* _URING_H_ */